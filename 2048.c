@@ -18,165 +18,193 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <utils/arc4random.h>
+#include <string.h>
 
-typedef unsigned uint;
+#include "play.h"
 
-static uint score;
-static uint grid[4][4];
+// Four by four boards keep to the packed grid and its tables, and only
+// they get hints. Other sizes use the sized kernels in tiles.c.
+struct State {
+	uint n;
+	Grid grid;
+	struct Tiles tiles;
+	uint score;
+	uint turns;
+	bool over;
+	bool autoplay;
+	bool autoplayed;
+	enum Dir hint;
+};
 
-static bool gameOver(void) {
-	for (uint y = 0; y < 4; ++y) {
-		for (uint x = 0; x < 4; ++x) {
-			if (!grid[y][x]) return false;
-		}
-	}
-	for (uint y = 0; y < 4; ++y) {
-		for (uint x = 0; x < 3; ++x) {
-			if (grid[y][x] == grid[y][x + 1]) return false;
-		}
-	}
-	for (uint x = 0; x < 4; ++x) {
-		for (uint y = 0; y < 3; ++y) {
-			if (grid[y][x] == grid[y + 1][x]) return false;
-		}
+enum {
+	DirtyGrid = 1 << 0,
+	DirtyScore = 1 << 1,
+	DirtyHint = 1 << 2,
+	DirtyHelp = 1 << 3,
+};
+
+enum {
+	HelpTurns = 3,
+	HintBudget = 100,
+	AutoDelay = 50,
+};
+
+static void start(struct State *state, uint n, struct Rng *rng) {
+	*state = (struct State) { .n = n, .hint = Dirs };
+	if (n == 4) {
+		gridInit();
+		state->grid = gridSpawn(gridSpawn(0, rng), rng);
+	} else {
+		tilesInit();
+		state->tiles = (struct Tiles) { .n = n };
+		state->tiles = tilesSpawn(tilesSpawn(state->tiles, rng), rng);
 	}
-	return true;
 }
 
-static void spawn(void) {
-	uint y, x;
-	do {
-		y = arc4random_uniform(4);
-		x = arc4random_uniform(4);
-	} while (grid[y][x]);
-	grid[y][x] = (arc4random_uniform(10) ? 1 : 2);
+static void init(void *ptr, struct Rng *rng) { start(ptr, 4, rng); }
+static void init3(void *ptr, struct Rng *rng) { start(ptr, 3, rng); }
+static void init5(void *ptr, struct Rng *rng) { start(ptr, 5, rng); }
+static void init6(void *ptr, struct Rng *rng) { start(ptr, 6, rng); }
+static void init8(void *ptr, struct Rng *rng) { start(ptr, 8, rng); }
+
+static bool over(const struct State *state) {
+	if (state->n != 4) return tilesOver(state->tiles);
+	return gridOver(state->grid);
 }
 
-static bool slideLeft(void) {
-	bool slid = false;
-	for (uint y = 0; y < 4; ++y) {
-		uint x = 0;
-		for (uint i = 0; i < 4; ++i) {
-			if (grid[y][i] != grid[y][x]) slid = true;
-			if (grid[y][i]) grid[y][x++] = grid[y][i];
-		}
-		while (x < 4) grid[y][x++] = 0;
-	}
-	return slid;
+static uint tileAt(const struct State *state, uint y, uint x) {
+	if (state->n != 4) return tilesTile(&state->tiles, y, x);
+	return gridTile(state->grid, y, x);
 }
-static bool slideRight(void) {
-	bool slid = false;
-	for (uint y = 0; y < 4; ++y) {
-		uint x = 3;
-		for (uint i = 3; i < 4; --i) {
-			if (grid[y][i] != grid[y][x]) slid = true;
-			if (grid[y][i]) grid[y][x--] = grid[y][i];
-		}
-		while (x < 4) grid[y][x--] = 0;
+
+static uint slide(struct State *state, enum Dir dir, struct Rng *rng) {
+	if (state->n != 4) {
+		struct Tiles next = tilesMove(state->tiles, dir, &state->score);
+		if (tilesEqual(next, state->tiles)) return 0;
+		state->tiles = tilesSpawn(next, rng);
+		return DirtyGrid | DirtyScore;
 	}
-	return slid;
+	Grid next = gridMove(state->grid, dir, &state->score);
+	if (next == state->grid) return 0;
+	state->grid = gridSpawn(next, rng);
+	return DirtyGrid | DirtyScore;
 }
-static bool slideUp(void) {
-	bool slid = false;
-	for (uint x = 0; x < 4; ++x) {
-		uint y = 0;
-		for (uint i = 0; i < 4; ++i) {
-			if (grid[i][x] != grid[y][x]) slid = true;
-			if (grid[i][x]) grid[y++][x] = grid[i][x];
+
+static uint step(void *ptr, int key, struct Rng *rng) {
+	struct State *state = ptr;
+	uint dirty = 0;
+	if (key == Tick) {
+		// Autoplay's ticks come as keys unless pick() found no move.
+		if (!state->autoplay) return 0;
+		state->autoplay = false;
+		dirty = DirtyHint;
+	} else {
+		if (state->hint < Dirs) dirty |= DirtyHint;
+		state->hint = Dirs;
+		switch (key) {
+			break; case 'h': case KEY_LEFT: dirty |= slide(state, Left, rng);
+			break; case 'j': case KEY_DOWN: dirty |= slide(state, Down, rng);
+			break; case 'k': case KEY_UP: dirty |= slide(state, Up, rng);
+			break; case 'l': case KEY_RIGHT: dirty |= slide(state, Right, rng);
+			break; case '?': {
+				if (state->n != 4) break;
+				state->hint = gridHint(state->grid, HintBudget).dir;
+				dirty |= DirtyHint;
+			}
+			break; case 'a': {
+				if (state->n != 4) break;
+				state->autoplay ^= true;
+				state->autoplayed = true;
+				dirty |= DirtyHint;
+			}
+			break; case 'q': return dirty | EventDone;
 		}
-		while (y < 4) grid[y++][x] = 0;
 	}
-	return slid;
-}
-static bool slideDown(void) {
-	bool slid = false;
-	for (uint x = 0; x < 4; ++x) {
-		uint y = 3;
-		for (uint i = 3; i < 4; --i) {
-			if (grid[i][x] != grid[y][x]) slid = true;
-			if (grid[i][x]) grid[y--][x] = grid[i][x];
-		}
-		while (y < 4) grid[y--][x] = 0;
+	if (++state->turns == HelpTurns) dirty |= DirtyHelp;
+	if (!state->over && over(state)) {
+		state->over = true;
+		dirty |= DirtyHelp | EventOver;
 	}
-	return slid;
+	return dirty;
 }
 
-static bool mergeLeft(void) {
-	bool merged = false;
-	for (uint y = 0; y < 4; ++y) {
-		for (uint x = 0; x < 3; ++x) {
-			if (!grid[y][x]) continue;
-			if (grid[y][x] != grid[y][x + 1]) continue;
-			score += 1 << ++grid[y][x];
-			grid[y][x + 1] = 0;
-			merged = true;
-		}
-	}
-	return merged;
-}
-static bool mergeRight(void) {
-	bool merged = false;
-	for (uint y = 0; y < 4; ++y) {
-		for (uint x = 3; x > 0; --x) {
-			if (!grid[y][x]) continue;
-			if (grid[y][x] != grid[y][x - 1]) continue;
-			score += 1 << ++grid[y][x];
-			grid[y][x - 1] = 0;
-			merged = true;
-		}
-	}
-	return merged;
+// Autoplay searches against the clock, so its move is chosen here and
+// recorded as the arrow key, which playback can step without searching.
+static int pick(const void *ptr) {
+	static const int Keys[Dirs] = { KEY_LEFT, KEY_RIGHT, KEY_UP, KEY_DOWN };
+	const struct State *state = ptr;
+	if (!state->autoplay) return Tick;
+	struct Hint next = gridHint(state->grid, HintBudget);
+	return (next.dir < Dirs ? Keys[next.dir] : Tick);
 }
-static bool mergeUp(void) {
-	bool merged = false;
-	for (uint x = 0; x < 4; ++x) {
-		for (uint y = 0; y < 3; ++y) {
-			if (!grid[y][x]) continue;
-			if (grid[y][x] != grid[y + 1][x]) continue;
-			score += 1 << ++grid[y][x];
-			grid[y + 1][x] = 0;
-			merged = true;
-		}
-	}
-	return merged;
+
+static int delay(const void *ptr) {
+	const struct State *state = ptr;
+	return (state->autoplay ? AutoDelay : Forever);
 }
-static bool mergeDown(void) {
-	bool merged = false;
-	for (uint x = 0; x < 4; ++x) {
-		for (uint y = 3; y > 0; --y) {
-			if (!grid[y][x]) continue;
-			if (grid[y][x] != grid[y - 1][x]) continue;
-			score += 1 << ++grid[y][x];
-			grid[y - 1][x] = 0;
-			merged = true;
-		}
-	}
-	return merged;
+
+// Scores earned by autoplay are not the player's own.
+static uint score(const void *ptr) {
+	const struct State *state = ptr;
+	return (state->autoplayed ? 0 : state->score);
 }
 
-static bool left(void) {
-	return slideLeft() | mergeLeft() | slideLeft();
+enum { SaveLen = 8 + 4 + 1 };
+
+// Other sizes save their n rows of 4 bytes in place of the grid.
+static size_t saveTiles(const struct State *state, byte *buf, size_t cap) {
+	byte data[4 * TilesMax + 4 + 1];
+	size_t len = 4 * state->n;
+	memcpy(&data[0], state->tiles.rows, len);
+	memcpy(&data[len], &state->score, 4);
+	data[len + 4] = state->autoplayed;
+	return saveCopy(buf, cap, data, len + 4 + 1);
 }
-static bool right(void) {
-	return slideRight() | mergeRight() | slideRight();
+
+static bool loadTiles(struct State *state, const byte *buf, size_t len) {
+	size_t rows = 4 * state->n;
+	if (len != rows + 4 + 1) return false;
+	memcpy(state->tiles.rows, &buf[0], rows);
+	uint32_t mask = ((uint64_t)1 << (4 * state->n)) - 1;
+	for (uint y = 0; y < state->n; ++y) {
+		state->tiles.rows[y] &= mask;
+	}
+	memcpy(&state->score, &buf[rows], 4);
+	state->autoplayed = buf[rows + 4];
+	state->autoplay = false;
+	state->over = tilesOver(state->tiles);
+	state->hint = Dirs;
+	return true;
 }
-static bool up(void) {
-	return slideUp() | mergeUp() | slideUp();
+
+static size_t save(const void *ptr, byte *buf, size_t cap) {
+	const struct State *state = ptr;
+	if (state->n != 4) return saveTiles(state, buf, cap);
+	byte data[SaveLen];
+	memcpy(&data[0], &state->grid, 8);
+	memcpy(&data[8], &state->score, 4);
+	data[12] = state->autoplayed;
+	return saveCopy(buf, cap, data, sizeof(data));
 }
-static bool down(void) {
-	return slideDown() | mergeDown() | slideDown();
+
+static bool load(void *ptr, const byte *buf, size_t len) {
+	struct State *state = ptr;
+	if (state->n != 4) return loadTiles(state, buf, len);
+	if (len != SaveLen) return false;
+	memcpy(&state->grid, &buf[0], 8);
+	memcpy(&state->score, &buf[8], 4);
+	state->autoplayed = buf[12];
+	state->autoplay = false;
+	state->over = gridOver(state->grid);
+	state->hint = Dirs;
+	return true;
 }
 
 static void curse(void) {
-	initscr();
-	cbreak();
 	noecho();
 	curs_set(0);
 	keypad(stdscr, true);
 	leaveok(stdscr, true);
-	start_color();
-	use_default_colors();
 	short bright = (COLORS > 8 ? 8 : 0);
 	init_pair(1,  bright + COLOR_WHITE, COLOR_RED);
 	init_pair(2,  bright + COLOR_WHITE, COLOR_GREEN);
@@ -200,88 +228,169 @@ static void addchn(char ch, uint n) {
 }
 
 enum {
-	TileHeight = 3,
-	TileWidth = 7,
 	GridY = 2,
 	GridX = 2,
 	ScoreY = 0,
-	ScoreX = GridX + 4 * TileWidth - 10,
 	HelpY = GridY,
-	HelpX = GridX + 5 * TileWidth,
+	HelpLines = 5,
 };
 
-static void drawTile(uint y, uint x) {
-	if (grid[y][x]) {
-		attr_set(A_BOLD, 1 + (grid[y][x] - 1) % 12, NULL);
+// Boards past 6x6 squeeze their tiles to fit in 80 by 24.
+struct Layout {
+	uint tileHeight;
+	uint tileWidth;
+	uint scoreX;
+	uint helpX;
+	uint hintY;
+};
+
+static struct Layout layout(uint n) {
+	struct Layout l = { .tileHeight = 3, .tileWidth = 7 };
+	if (n > 6) l = (struct Layout) { .tileHeight = 2, .tileWidth = 6 };
+	l.scoreX = GridX + n * l.tileWidth - 10;
+	l.helpX = GridX + (n + 1) * l.tileWidth;
+	l.hintY = GridY + n * l.tileHeight - 1;
+	return l;
+}
+
+static void drawHint(const struct State *state) {
+	static const char *Names[Dirs] = { "left", "right", "up", "down" };
+	if (state->n != 4) return;
+	struct Layout l = layout(state->n);
+	char buf[32] = "";
+	if (state->autoplay) {
+		snprintf(buf, sizeof(buf), "Autoplay, a to stop.");
+	} else if (state->hint < Dirs) {
+		snprintf(buf, sizeof(buf), "Hint: slide %s.", Names[state->hint]);
+	}
+	attr_set(A_NORMAL, 0, NULL);
+	mvprintw(l.hintY, l.helpX, "%-22s", buf);
+}
+
+static void drawTile(const struct State *state, uint y, uint x) {
+	struct Layout l = layout(state->n);
+	uint tile = tileAt(state, y, x);
+	if (tile) {
+		attr_set(A_BOLD, 1 + (tile - 1) % 12, NULL);
 	} else {
 		attr_set(A_NORMAL, 13, NULL);
 	}
 
 	char buf[8];
-	int len = snprintf(buf, sizeof(buf), "%d", 1 << grid[y][x]);
-	if (!grid[y][x]) buf[0] = '.';
-
-	move(GridY + TileHeight * y, GridX + TileWidth * x);
-	addchn(' ', TileWidth);
+	int len = snprintf(buf, sizeof(buf), "%d", 1 << tile);
+	if (!tile) buf[0] = '.';
 
-	move(GridY + TileHeight * y + 1, GridX + TileWidth * x);
-	addchn(' ', (TileWidth - len + 1) / 2);
-	addstr(buf);
-	addchn(' ', (TileWidth - len) / 2);
-
-	move(GridY + TileHeight * y + 2, GridX + TileWidth * x);
-	addchn(' ', TileWidth);
+	for (uint i = 0; i < l.tileHeight; ++i) {
+		move(GridY + l.tileHeight * y + i, GridX + l.tileWidth * x);
+		if (i != (l.tileHeight - 1) / 2) {
+			addchn(' ', l.tileWidth);
+			continue;
+		}
+		addchn(' ', (l.tileWidth - len + 1) / 2);
+		addstr(buf);
+		addchn(' ', (l.tileWidth - len) / 2);
+	}
 }
 
-static void draw(void) {
-	char buf[11];
-	snprintf(buf, sizeof(buf), "%10d", score);
-
+static void drawHelp(const struct State *state) {
+	uint x = layout(state->n).helpX;
 	attr_set(A_NORMAL, 0, NULL);
-	mvaddstr(ScoreY, ScoreX, buf);
+	for (uint i = 0; i < HelpLines; ++i) {
+		move(HelpY + i, x);
+		clrtoeol();
+	}
+	if (state->over) {
+		mvaddstr(HelpY + 0, x, "Game over! Press q to");
+		mvaddstr(HelpY + 1, x, "view the scoreboard.");
+	} else if (state->turns < HelpTurns && state->n != 4) {
+		mvaddstr(HelpY + 0, x, "Use the arrow keys to");
+		mvaddstr(HelpY + 1, x, "slide and merge tiles.");
+		mvaddstr(HelpY + 2, x, "Press q to quit.");
+	} else if (state->turns < HelpTurns) {
+		mvaddstr(HelpY + 0, x, "Use the arrow keys to");
+		mvaddstr(HelpY + 1, x, "slide and merge tiles.");
+		mvaddstr(HelpY + 2, x, "Press ? for a hint,");
+		mvaddstr(HelpY + 3, x, "a for autoplay");
+		mvaddstr(HelpY + 4, x, "or q to quit.");
+	}
+}
 
-	for (uint y = 0; y < 4; ++y) {
-		for (uint x = 0; x < 4; ++x) {
-			drawTile(y, x);
+static void render(const void *ptr, uint dirty) {
+	const struct State *state = ptr;
+	if (dirty & DirtyHelp) drawHelp(state);
+	if (dirty & DirtyScore) {
+		char buf[11];
+		snprintf(buf, sizeof(buf), "%10d", state->score);
+		attr_set(A_NORMAL, 0, NULL);
+		mvaddstr(ScoreY, layout(state->n).scoreX, buf);
+	}
+	if (dirty & DirtyGrid) {
+		for (uint y = 0; y < state->n; ++y) {
+			for (uint x = 0; x < state->n; ++x) {
+				drawTile(state, y, x);
+			}
 		}
 	}
+	if (dirty & DirtyHint) drawHint(state);
 }
 
-static void drawHelp(void) {
-	attr_set(A_NORMAL, 0, NULL);
-	mvaddstr(HelpY + 0, HelpX, "Use the arrow keys to");
-	mvaddstr(HelpY + 1, HelpX, "slide and merge tiles.");
-	mvaddstr(HelpY + 2, HelpX, "Press q to quit.");
-}
+const struct Engine Engine2048 = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init,
+	.step = step,
+	.pick = pick,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
 
-static void drawGameOver(void) {
-	attr_set(A_NORMAL, 0, NULL);
-	mvaddstr(HelpY + 0, HelpX, "Game over! Press q to");
-	mvaddstr(HelpY + 1, HelpX, "view the scoreboard.");
-}
+const struct Engine Engine2048x3 = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init3,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
 
-static bool input(void) {
-	switch (getch()) {
-		break; case 'h': case KEY_LEFT: if (left()) spawn();
-		break; case 'j': case KEY_DOWN: if (down()) spawn();
-		break; case 'k': case KEY_UP: if (up()) spawn();
-		break; case 'l': case KEY_RIGHT: if (right()) spawn();
-		break; case 'q': return false;
-		break; case ERR: exit(EXIT_FAILURE);
-	}
-	return true;
-}
+const struct Engine Engine2048x5 = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init5,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
 
-uint play2048(void) {
-	curse();
-	spawn();
-	spawn();
-	drawHelp();
-	uint help = 0;
-	do {
-		if (help++ == 3) erase();
-		if (gameOver()) drawGameOver();
-		draw();
-	} while (input());
-	return score;
-}
+const struct Engine Engine2048x6 = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init6,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
+
+const struct Engine Engine2048x8 = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init8,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
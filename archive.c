@@ -0,0 +1,491 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// An archive is a directory of segment files, to which each recording is
+// appended whole, 8-byte aligned, followed by its keyframes, and an index
+// of one Entry per recording after IndexMagic. Both are mapped to read.
+
+enum {
+	SegmentCap = 64 << 20,
+	SaveCap = 8192,
+};
+
+static const char IndexMagic[8] = "archive\1";
+struct Entry {
+	int64_t date;
+	uint64_t seed;
+	uint64_t offset;
+	uint32_t segment;
+	uint32_t len;
+	uint32_t keys;
+	uint32_t keysLen;
+	uint32_t score;
+	uint32_t steps;
+	char game[24];
+	char name[32];
+};
+
+static const char *dir = "archives";
+
+static const char *map;
+static size_t mapLen;
+static const struct Entry *entries;
+static size_t entriesLen;
+
+static void indexMap(int fd) {
+	struct stat st;
+	if (fstat(fd, &st)) err(EX_IOERR, "%s/index", dir);
+	if (map) munmap((void *)map, mapLen);
+	map = NULL;
+	entries = NULL;
+	entriesLen = 0;
+	if ((size_t)st.st_size < sizeof(IndexMagic)) return;
+	mapLen = st.st_size;
+	map = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) err(EX_IOERR, "%s/index", dir);
+	if (memcmp(map, IndexMagic, sizeof(IndexMagic))) {
+		errx(EX_DATAERR, "%s/index: not an archive index", dir);
+	}
+	entries = (const struct Entry *)&map[sizeof(IndexMagic)];
+	entriesLen = (mapLen - sizeof(IndexMagic)) / sizeof(*entries);
+}
+
+static struct Score *boards;
+static size_t boardsLen;
+
+// Names come from the scoreboard entries of the same sessions.
+static void boardsRead(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (!file) err(EX_NOINPUT, "%s", path);
+	scoresRead(file);
+	fclose(file);
+	boards = realloc(boards, sizeof(*boards) * (boardsLen + ScoresLen));
+	if (!boards) err(EX_OSERR, "realloc");
+	for (size_t i = 0; i < ScoresLen && scores[i].score; ++i) {
+		boards[boardsLen++] = scores[i];
+	}
+}
+
+static const char *boardsName(time_t date, uint score) {
+	for (size_t i = 0; i < boardsLen; ++i) {
+		if (boards[i].date == date && boards[i].score == score) {
+			return boards[i].name;
+		}
+	}
+	return "";
+}
+
+static struct {
+	struct Keyframe *keys;
+	size_t len, cap;
+	byte *saves;
+	size_t savesLen, savesCap;
+} frames;
+
+static void framesPush(const struct Keyframe *key, const byte *save) {
+	if (frames.len == frames.cap) {
+		frames.cap = (frames.cap ? frames.cap * 2 : 64);
+		frames.keys = realloc(frames.keys, sizeof(*frames.keys) * frames.cap);
+		if (!frames.keys) err(EX_OSERR, "realloc");
+	}
+	while (frames.savesLen + key->len > frames.savesCap) {
+		frames.savesCap = (frames.savesCap ? frames.savesCap * 2 : 65536);
+		frames.saves = realloc(frames.saves, frames.savesCap);
+		if (!frames.saves) err(EX_OSERR, "realloc");
+	}
+	frames.keys[frames.len] = *key;
+	frames.keys[frames.len++].offset = frames.savesLen;
+	memcpy(&frames.saves[frames.savesLen], save, key->len);
+	frames.savesLen += key->len;
+}
+
+static bool same(
+	const struct Engine *engine, const void *state, const void *probe
+) {
+	static byte a[SaveCap], b[SaveCap];
+	size_t len = engine->save(state, a, sizeof(a));
+	if (engine->save(probe, b, sizeof(b)) != len) return false;
+	return len <= sizeof(a) && !memcmp(a, b, len);
+}
+
+// Replays a recording, keeping a keyframe about every steps. A keyframe
+// is only kept if a state seated from it plays the same as the recording
+// up to the next one, since saves leave out things like queued keys.
+static bool build(
+	const struct Recording *rec, const struct Engine *engine,
+	uint every, struct Entry *entry
+) {
+	frames.len = 0;
+	frames.savesLen = 0;
+	void *state = calloc(1, engine->size);
+	void *probe = calloc(1, engine->size);
+	if (!state || !probe) err(EX_OSERR, "calloc");
+	struct Rng rng, probeRng;
+	bool ok = recordReset(rec, engine, state, &rng);
+
+	static byte save[SaveCap];
+	struct Keyframe key;
+	bool probing = false;
+	size_t next = every, i;
+	for (i = 0; ok && i < rec->len; ++i) {
+		if (!probing && i >= next) {
+			key = (struct Keyframe) {
+				.rng = rng.state,
+				.draws = rng.len,
+				.step = i,
+				.len = engine->save(state, save, sizeof(save)),
+			};
+			probing = key.len <= sizeof(save) && recordSeat(
+				rec, engine, probe, &probeRng, &key, save
+			);
+		}
+		int ch = rec->steps[i].key;
+		uint events = engine->step(state, ch, &rng);
+		if (probing) {
+			engine->step(probe, ch, &probeRng);
+			if (!same(engine, state, probe)) {
+				probing = false;
+				next = i + 1;
+			}
+		}
+		bool last = (events & EventDone) || i + 1 == rec->len;
+		if (probing && (i + 1 - key.step >= every || last)) {
+			framesPush(&key, save);
+			probing = false;
+			next = i + 1;
+		}
+		if (events & EventDone) break;
+	}
+	entry->steps = (i < rec->len ? i + 1 : i);
+	entry->score = engine->score(state);
+	entry->keysLen = frames.len;
+	if (engine->fini) {
+		engine->fini(state);
+		engine->fini(probe);
+	}
+	free(state);
+	free(probe);
+	return ok;
+}
+
+// Tournament entrants share one seed, so a recording is known by its
+// seed, start, game and length together.
+struct Ident {
+	uint64_t seed;
+	int64_t date;
+	uint32_t len;
+	char game[24];
+};
+
+static struct Ident ident(const struct Entry *entry) {
+	struct Ident id = {
+		.seed = entry->seed, .date = entry->date, .len = entry->len,
+	};
+	snprintf(id.game, sizeof(id.game), "%s", entry->game);
+	return id;
+}
+
+static int compareIdent(const void *a, const void *b) {
+	const struct Ident *x = a, *y = b;
+	if (x->seed != y->seed) return (x->seed > y->seed) - (x->seed < y->seed);
+	if (x->date != y->date) return (x->date > y->date) - (x->date < y->date);
+	if (x->len != y->len) return (x->len > y->len) - (x->len < y->len);
+	return strcmp(x->game, y->game);
+}
+
+static byte *readAll(const char *path, size_t *len) {
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		warn("%s", path);
+		return NULL;
+	}
+	byte *data = NULL;
+	size_t cap = 0;
+	*len = 0;
+	for (;;) {
+		if (*len == cap) {
+			cap = (cap ? cap * 2 : 4096);
+			data = realloc(data, cap);
+			if (!data) err(EX_OSERR, "realloc");
+		}
+		size_t n = fread(&data[*len], 1, cap - *len, file);
+		if (!n) break;
+		*len += n;
+	}
+	if (ferror(file)) err(EX_IOERR, "%s", path);
+	fclose(file);
+	return data;
+}
+
+static int segmentOpen(uint segment, int flags) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%u.seg", dir, segment);
+	int fd = open(path, flags, 0644);
+	if (fd < 0) err(EX_CANTCREAT, "%s", path);
+	return fd;
+}
+
+static size_t align(size_t n) {
+	return (n + 7) & ~(size_t)7;
+}
+
+static void add(int argc, char *argv[], uint every) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/index", dir);
+	int fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) err(EX_CANTCREAT, "%s", path);
+	if (flock(fd, LOCK_EX)) err(EX_IOERR, "%s", path);
+	indexMap(fd);
+	if (!entries) {
+		if (ftruncate(fd, 0)) err(EX_IOERR, "%s", path);
+		ssize_t n = write(fd, IndexMagic, sizeof(IndexMagic));
+		if (n < 0) err(EX_IOERR, "%s", path);
+	}
+
+	struct Ident *idents = malloc(sizeof(*idents) * (entriesLen + 1));
+	if (!idents) err(EX_OSERR, "malloc");
+	for (size_t i = 0; i < entriesLen; ++i) {
+		idents[i] = ident(&entries[i]);
+	}
+	qsort(idents, entriesLen, sizeof(*idents), compareIdent);
+	uint segment = (entriesLen ? entries[entriesLen - 1].segment : 0);
+	int seg = segmentOpen(segment, O_WRONLY | O_APPEND | O_CREAT);
+
+	size_t added = 0, skipped = 0, bytes = 0, keys = 0;
+	for (int i = 0; i < argc; ++i) {
+		size_t len;
+		byte *data = readAll(argv[i], &len);
+		if (!data) continue;
+		struct Recording rec;
+		const struct Engine *engine = NULL;
+		if (recordParse(&rec, data, len)) {
+			engine = recordEngine(rec.head.game);
+		}
+		if (!engine) {
+			warnx("%s: not a recording", argv[i]);
+			skipped++;
+			goto next;
+		}
+		struct Entry entry = {
+			.date = rec.head.date,
+			.seed = rec.head.seed,
+			.len = len,
+			.keys = align(len),
+		};
+		snprintf(entry.game, sizeof(entry.game), "%s", rec.head.game);
+		struct Ident id = ident(&entry);
+		if (bsearch(&id, idents, entriesLen, sizeof(*idents), compareIdent)) {
+			skipped++;
+			goto next;
+		}
+
+		if (!build(&rec, engine, every, &entry)) {
+			warnx("%s: bad save", argv[i]);
+			skipped++;
+			goto next;
+		}
+		snprintf(
+			entry.name, sizeof(entry.name), "%s",
+			boardsName(entry.date, entry.score)
+		);
+
+		struct stat st;
+		if (fstat(seg, &st)) err(EX_IOERR, "%u.seg", segment);
+		size_t total = entry.keys + sizeof(*frames.keys) * frames.len
+			+ frames.savesLen;
+		if (st.st_size && align(st.st_size) + total > SegmentCap) {
+			close(seg);
+			seg = segmentOpen(++segment, O_WRONLY | O_APPEND | O_CREAT);
+			st.st_size = 0;
+		}
+		entry.segment = segment;
+		entry.offset = align(st.st_size);
+
+		// Each recording goes in with one write, so it's whole or absent.
+		size_t pad = entry.offset - st.st_size;
+		size_t cap = pad + total;
+		byte *buf = calloc(1, cap);
+		if (!buf) err(EX_OSERR, "calloc");
+		memcpy(&buf[pad], data, len);
+		byte *ptr = &buf[pad + entry.keys];
+		memcpy(ptr, frames.keys, sizeof(*frames.keys) * frames.len);
+		ptr += sizeof(*frames.keys) * frames.len;
+		memcpy(ptr, frames.saves, frames.savesLen);
+		ssize_t n = write(seg, buf, cap);
+		if (n < 0 || (size_t)n != cap) err(EX_IOERR, "%u.seg", segment);
+		free(buf);
+		n = write(fd, &entry, sizeof(entry));
+		if (n < 0) err(EX_IOERR, "%s", path);
+
+		added++;
+		bytes += total;
+		keys += frames.len;
+next:
+		recordFree(&rec);
+		free(data);
+	}
+	close(seg);
+	close(fd);
+	free(idents);
+	printf(
+		"added %zu skipped %zu bytes %zu keyframes %zu\n",
+		added, skipped, bytes, keys
+	);
+}
+
+static struct {
+	const char *game;
+	const char *name;
+	time_t since;
+} query;
+
+static bool match(const struct Entry *entry) {
+	if (query.game && strncmp(entry->game, query.game, sizeof(entry->game))) {
+		return false;
+	}
+	if (query.name && strncmp(entry->name, query.name, sizeof(entry->name))) {
+		return false;
+	}
+	return entry->date >= query.since;
+}
+
+static int compareEntry(const void *a, const void *b) {
+	const struct Entry *x = *(const struct Entry **)a;
+	const struct Entry *y = *(const struct Entry **)b;
+	if (x->score != y->score) {
+		return (x->score < y->score) - (x->score > y->score);
+	}
+	return (x->date > y->date) - (x->date < y->date);
+}
+
+// Ranks the entries that match the query, highest score first.
+static const struct Entry **rank(size_t *len) {
+	const struct Entry **ranks = malloc(sizeof(*ranks) * (entriesLen + 1));
+	if (!ranks) err(EX_OSERR, "malloc");
+	*len = 0;
+	for (size_t i = 0; i < entriesLen; ++i) {
+		if (match(&entries[i])) ranks[(*len)++] = &entries[i];
+	}
+	qsort(ranks, *len, sizeof(*ranks), compareEntry);
+	return ranks;
+}
+
+static void list(size_t count) {
+	size_t len;
+	const struct Entry **ranks = rank(&len);
+	for (size_t i = 0; i < len && i < count; ++i) {
+		const struct Entry *entry = ranks[i];
+		time_t date = entry->date;
+		char buf[sizeof("YYYY-MM-DD HH:MM")];
+		strftime(buf, sizeof(buf), "%F %R", localtime(&date));
+		printf(
+			"%4zu. %10u  %-31.32s  %s  %-8.24s %7u steps %3u keyframes\n",
+			1 + i, entry->score, entry->name, buf, entry->game,
+			entry->steps, entry->keysLen
+		);
+	}
+	free(ranks);
+}
+
+static int play(size_t n, size_t start, double speed) {
+	size_t len;
+	const struct Entry **ranks = rank(&len);
+	if (!n || n > len) errx(EX_NOINPUT, "no entry ranked %zu", n);
+	const struct Entry *entry = ranks[n - 1];
+	free(ranks);
+
+	int fd = segmentOpen(entry->segment, O_RDONLY);
+	struct stat st;
+	if (fstat(fd, &st)) err(EX_IOERR, "%u.seg", entry->segment);
+	size_t end = entry->offset + entry->keys
+		+ sizeof(struct Keyframe) * entry->keysLen;
+	if ((size_t)st.st_size < end) {
+		errx(EX_DATAERR, "%u.seg: truncated", entry->segment);
+	}
+	const byte *seg = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (seg == MAP_FAILED) err(EX_IOERR, "%u.seg", entry->segment);
+	close(fd);
+
+	struct Recording rec;
+	const byte *data = &seg[entry->offset];
+	if (!recordParse(&rec, data, entry->len)) {
+		errx(EX_DATAERR, "%u.seg: bad recording", entry->segment);
+	}
+	rec.keys = (const struct Keyframe *)&data[entry->keys];
+	rec.keysLen = entry->keysLen;
+	const struct Engine *engine = recordEngine(rec.head.game);
+	if (!engine) errx(EX_DATAERR, "unknown game %s", rec.head.game);
+	int status = recordPlay(&rec, engine, speed, start);
+	recordFree(&rec);
+	munmap((void *)seg, st.st_size);
+	return status;
+}
+
+int main(int argc, char *argv[]) {
+	uint every = 256;
+	size_t count = 10;
+	size_t playing = 0;
+	size_t start = 0;
+	double speed = 1;
+	for (int opt; 0 < (opt = getopt(argc, argv, "b:c:d:g:k:n:o:p:s:w"));) {
+		switch (opt) {
+			break; case 'b': boardsRead(optarg);
+			break; case 'c': count = strtoul(optarg, NULL, 10);
+			break; case 'd': dir = optarg;
+			break; case 'g': query.game = optarg;
+			break; case 'k': every = strtoul(optarg, NULL, 10);
+			break; case 'n': query.name = optarg;
+			break; case 'o': start = strtoul(optarg, NULL, 10);
+			break; case 'p': playing = strtoul(optarg, NULL, 10);
+			break; case 's': speed = strtod(optarg, NULL);
+			break; case 'w': query.since = time(NULL) - 7 * 24 * 60 * 60;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (!every) errx(EX_USAGE, "bad keyframe interval");
+	if (speed <= 0) errx(EX_USAGE, "bad speed");
+	gridInit();
+	tilesInit();
+
+	if (optind < argc) {
+		add(argc - optind, &argv[optind], every);
+		return EX_OK;
+	}
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/index", dir);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) err(EX_NOINPUT, "%s", path);
+	indexMap(fd);
+	close(fd);
+	if (playing) return play(playing, start, speed);
+	list(count);
+	return EX_OK;
+}
@@ -0,0 +1,627 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Multiplayer snake. Every session maps the same world file. Whichever
+// session holds the flock on it runs the tick loop in a thread; the rest
+// only write their input and heartbeat into their player slot. Each tick
+// writes its cell changes into the world and into a delta record, then
+// publishes the tick number. Sessions keep a private copy of the cells,
+// apply the deltas in order and fall back to copying the whole world if
+// they lag too far behind, so nothing ever waits on a lock.
+//
+// Bodies are linked through the cells themselves, each segment pointing
+// towards the next one, so a tick costs the same however long the snakes
+// are and however big the arena is. Dead snakes shrink from the tail a
+// few cells per tick.
+
+enum {
+	Rows = 64,
+	Cols = 128,
+	Cells = Rows * Cols,
+	PlayersCap = 32,
+	ArenaFood = 1024,
+	FoodPer = 4,
+	DeltaTicks = 64,
+	DeltaCap = PlayersCap * 8,
+	CorpseRate = 4,
+	Timeout = 100,
+	TickUsec = 150000,
+	FrameUsec = 30000,
+};
+
+static const int DY[4] = {  0, +1, -1,  0 };
+static const int DX[4] = { -1,  0,  0, +1 };
+enum { Quit = 4, Gone };
+
+enum Kind { Empty, Food, Body, Head };
+static uint16_t cell(enum Kind kind, uint dir, uint data) {
+	return kind | dir << 2 | data << 4;
+}
+static enum Kind cellKind(uint16_t cell) { return cell & 3; }
+static uint cellDir(uint16_t cell) { return cell >> 2 & 3; }
+static uint cellData(uint16_t cell) { return cell >> 4; }
+
+enum State { Free, Joining, Alive, Corpse, Dead };
+enum Reason { Wall, Self, Other, Spoiled, Satisfied, Lost, Full };
+static const char *Reasons[] = {
+	[Wall] = "You eated the wall D:",
+	[Self] = "You eated yourself :(",
+	[Other] = "You eated someone else :o",
+	[Spoiled] = "You ate spoiled food!",
+	[Satisfied] = "You are satisfied.",
+	[Lost] = "You wandered off.",
+	[Full] = "The arena is full.",
+};
+
+struct Player {
+	atomic_uint state;
+	atomic_uint input;
+	atomic_uint_least64_t seen;
+	atomic_uint score;
+	atomic_uint len;
+	atomic_uint head;
+	uint tail;
+	uint dir;
+	enum Reason reason;
+};
+
+struct Delta {
+	atomic_uint_least64_t tick;
+	uint len;
+	struct {
+		uint32_t cell;
+		uint16_t value;
+	} cells[DeltaCap];
+};
+
+static const char Magic[8] = "arena\0\0\2";
+
+static struct Shared {
+	char magic[8];
+	atomic_uint_least64_t tick;
+	struct Player players[PlayersCap];
+	// Food leaves the FIFO only when it mulches, so what is still on the
+	// board, uneaten, is counted apart.
+	uint foodHead, foodTail, foodLive;
+	struct {
+		uint cell;
+		uint64_t born;
+	} food[ArenaFood];
+	struct Delta deltas[DeltaTicks];
+	uint16_t cells[Cells];
+} *world;
+static int worldFD = -1;
+
+void prepArena(void) {
+	const char *path = "arena.world";
+	worldFD = open(path, O_RDWR | O_CREAT, 0644);
+	if (worldFD < 0) err(EX_CANTCREAT, "%s", path);
+	int error = ftruncate(worldFD, sizeof(*world));
+	if (error) err(EX_IOERR, "%s", path);
+	world = mmap(
+		NULL, sizeof(*world), PROT_READ | PROT_WRITE, MAP_SHARED, worldFD, 0
+	);
+	if (world == MAP_FAILED) err(EX_OSERR, "mmap");
+}
+
+static struct Rng rng;
+static struct Delta *delta;
+
+// A tick that overflows its delta never publishes it, so sessions resync.
+static void set(uint i, uint16_t value) {
+	world->cells[i] = value;
+	if (delta->len < DeltaCap) {
+		delta->cells[delta->len].cell = i;
+		delta->cells[delta->len].value = value;
+	}
+	delta->len++;
+}
+
+static uint next(uint i, uint dir) {
+	return (DY[dir] * Cols + DX[dir]) + i;
+}
+
+static void shrink(struct Player *player) {
+	uint len = player->len;
+	if (len == 1) {
+		set(player->head, cell(Empty, 0, 0));
+	} else {
+		uint tail = player->tail;
+		player->tail = next(tail, cellDir(world->cells[tail]));
+		set(tail, cell(Empty, 0, 0));
+	}
+	player->len = len - 1;
+}
+
+static void die(struct Player *player, enum Reason reason) {
+	player->reason = reason;
+	player->state = Corpse;
+}
+
+static void spawn(struct Player *player, uint index) {
+	for (uint try = 0; try < 16; ++try) {
+		int y = 2 + rngUniform(&rng, Rows - 4);
+		int x = 2 + rngUniform(&rng, Cols - 4);
+		uint dir = (x < Cols / 2 ? 3 : 0);
+		uint i = y * Cols + x;
+		bool clear = true;
+		for (uint j = 0, k = i; clear && j < 4; ++j, k = next(k, dir)) {
+			if (world->cells[k]) clear = false;
+		}
+		if (!clear) continue;
+		set(i, cell(Head, 0, index));
+		player->head = player->tail = i;
+		player->len = 1;
+		player->score = 0;
+		player->dir = dir;
+		player->input = dir;
+		player->state = Alive;
+		return;
+	}
+}
+
+static void step(struct Player *player, uint index, uint64_t tick) {
+	if (tick - player->seen > Timeout) {
+		die(player, Lost);
+		return;
+	}
+	uint input = player->input;
+	if (input == Quit) {
+		die(player, Satisfied);
+		return;
+	}
+	if (input < 4 && input != 3 - player->dir) player->dir = input;
+	uint dir = player->dir;
+
+	uint head = player->head;
+	int y = head / Cols + DY[dir];
+	int x = head % Cols + DX[dir];
+	if (y < 0 || x < 0 || y >= Rows || x >= Cols) {
+		die(player, Wall);
+		return;
+	}
+	uint dest = y * Cols + x;
+	bool grow = false;
+	if (cellKind(world->cells[dest]) == Food) {
+		uint64_t age = tick - world->food[cellData(world->cells[dest])].born;
+		if (age > FoodSpoil) {
+			die(player, Spoiled);
+			return;
+		}
+		player->score += player->len * (age > FoodRipe ? 2 : 1);
+		world->foodLive--;
+		grow = true;
+	}
+	uint len = player->len;
+	if (!grow && len > 1) shrink(player);
+	uint16_t there = world->cells[dest];
+	if (cellKind(there) == Body || cellKind(there) == Head) {
+		die(player, (cellData(there) == index ? Self : Other));
+		return;
+	}
+	if (grow || len > 1) {
+		set(head, cell(Body, dir, index));
+	} else {
+		set(head, cell(Empty, 0, 0));
+		player->tail = dest;
+	}
+	set(dest, cell(Head, 0, index));
+	player->head = dest;
+	player->len = (grow ? len + 1 : len);
+}
+
+static void foodPlace(uint64_t tick) {
+	if (world->foodHead - world->foodTail == ArenaFood) return;
+	uint i = rngUniform(&rng, Cells);
+	if (world->cells[i]) return;
+	uint slot = world->foodHead++ % ArenaFood;
+	world->food[slot].cell = i;
+	world->food[slot].born = tick;
+	set(i, cell(Food, 0, slot));
+	world->foodLive++;
+}
+
+static void foodMulch(uint64_t tick) {
+	while (world->foodTail != world->foodHead) {
+		uint slot = world->foodTail % ArenaFood;
+		if (tick - world->food[slot].born < FoodMulch) break;
+		uint i = world->food[slot].cell;
+		if (world->cells[i] == cell(Food, 0, slot)) {
+			set(i, cell(Empty, 0, 0));
+			world->foodLive--;
+		}
+		world->foodTail++;
+	}
+}
+
+static void tick(void) {
+	uint64_t tick = world->tick + 1;
+	delta = &world->deltas[tick % DeltaTicks];
+	delta->tick = 0;
+	atomic_thread_fence(memory_order_release);
+	delta->len = 0;
+
+	foodMulch(tick);
+	uint alive = 0;
+	for (uint i = 0; i < PlayersCap; ++i) {
+		struct Player *player = &world->players[i];
+		switch (player->state) {
+			break; case Joining: {
+				if (tick - player->seen > Timeout) {
+					player->state = Free;
+				} else {
+					spawn(player, i);
+				}
+			}
+			break; case Alive: {
+				step(player, i, tick);
+				alive++;
+			}
+			break; case Corpse: {
+				for (uint j = 0; j < CorpseRate && player->len; ++j) {
+					shrink(player);
+				}
+				if (!player->len) player->state = Dead;
+			}
+			break; case Dead: {
+				if (player->input == Gone || tick - player->seen > Timeout) {
+					player->state = Free;
+				}
+			}
+		}
+	}
+	for (uint i = 0; i < alive && world->foodLive < FoodPer * alive; ++i) {
+		if (!rngUniform(&rng, FoodChance)) foodPlace(tick);
+	}
+
+	if (delta->len <= DeltaCap) atomic_store(&delta->tick, tick);
+	atomic_store(&world->tick, tick);
+}
+
+static void *ticker(void *ptr) {
+	(void)ptr;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	for (;;) {
+		deadline.tv_nsec += TickUsec * 1000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		struct timespec now, wait;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wait.tv_sec = deadline.tv_sec - now.tv_sec;
+		wait.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if (wait.tv_nsec < 0) {
+			wait.tv_sec--;
+			wait.tv_nsec += 1000000000;
+		}
+		if (wait.tv_sec >= 0) nanosleep(&wait, NULL);
+		tick();
+	}
+	return NULL;
+}
+
+static bool inBounds(uint i, uint dir) {
+	int y = i / Cols + DY[dir];
+	int x = i % Cols + DX[dir];
+	return y >= 0 && x >= 0 && y < Rows && x < Cols;
+}
+
+// The world file outlives any one build or crash, so check everything the
+// tick would follow or index before trusting it.
+static bool intact(void) {
+	for (uint i = 0; i < Cells; ++i) {
+		uint16_t c = world->cells[i];
+		switch (cellKind(c)) {
+			break; case Empty: if (c) return false;
+			break; case Food: if (cellData(c) >= ArenaFood) return false;
+			break; case Body: {
+				if (cellData(c) >= PlayersCap) return false;
+				if (!inBounds(i, cellDir(c))) return false;
+			}
+			break; case Head: if (cellData(c) >= PlayersCap) return false;
+		}
+	}
+	for (uint i = 0; i < PlayersCap; ++i) {
+		const struct Player *player = &world->players[i];
+		if (player->state > Dead || player->reason > Full) return false;
+		if (player->dir > 3) return false;
+		if (player->head >= Cells || player->tail >= Cells) return false;
+		if (player->state != Alive && player->state != Corpse) continue;
+		if (!player->len || player->len > Cells) return false;
+		uint j = player->tail;
+		for (uint n = 1; n < player->len; ++n) {
+			uint16_t c = world->cells[j];
+			if (c != cell(Body, cellDir(c), i)) return false;
+			j = next(j, cellDir(c));
+		}
+		if (j != player->head || world->cells[j] != cell(Head, 0, i)) {
+			return false;
+		}
+	}
+	if (world->foodHead - world->foodTail > ArenaFood) return false;
+	for (uint i = 0; i < ArenaFood; ++i) {
+		if (world->food[i].cell >= Cells) return false;
+	}
+	for (uint i = 0; i < DeltaTicks; ++i) {
+		const struct Delta *delta = &world->deltas[i];
+		for (uint j = 0; j < delta->len && j < DeltaCap; ++j) {
+			if (delta->cells[j].cell >= Cells) return false;
+		}
+	}
+	return true;
+}
+
+static bool ticking;
+static void elect(void) {
+	if (ticking) return;
+	if (flock(worldFD, LOCK_EX | LOCK_NB)) {
+		if (errno == EWOULDBLOCK) return;
+		err(EX_IOERR, "flock");
+	}
+	if (memcmp(world->magic, Magic, sizeof(Magic)) || !intact()) {
+		memset(world, 0, sizeof(*world));
+		memcpy(world->magic, Magic, sizeof(Magic));
+	}
+	ticking = true;
+	pthread_t thread;
+	int error = pthread_create(&thread, NULL, ticker, NULL);
+	if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+}
+
+// Each session keeps its own copy of the cells as of cellsTick.
+struct Session {
+	struct Player *me;
+	bool over;
+	uint score;
+	enum Reason reason;
+	uint64_t cellsTick;
+	uint16_t cells[Cells];
+};
+
+static struct Delta copy;
+
+static void resync(struct Session *session) {
+	session->cellsTick = world->tick;
+	memcpy(
+		session->cells, (uint16_t *)world->cells, sizeof(session->cells)
+	);
+}
+
+static void update(struct Session *session) {
+	uint64_t latest = world->tick;
+	if (latest - session->cellsTick >= DeltaTicks / 2) resync(session);
+	while (session->cellsTick < latest) {
+		uint64_t tick = session->cellsTick + 1;
+		struct Delta *delta = &world->deltas[tick % DeltaTicks];
+		if (delta->tick != tick) {
+			resync(session);
+			continue;
+		}
+		copy.len = delta->len;
+		if (copy.len > DeltaCap) {
+			resync(session);
+			continue;
+		}
+		memcpy(copy.cells, delta->cells, sizeof(copy.cells[0]) * copy.len);
+		atomic_thread_fence(memory_order_acquire);
+		if (delta->tick != tick) {
+			resync(session);
+			continue;
+		}
+		for (uint i = 0; i < copy.len; ++i) {
+			session->cells[copy.cells[i].cell] = copy.cells[i].value;
+		}
+		session->cellsTick = tick;
+	}
+}
+
+// Returns NULL once every slot is taken.
+static struct Player *join(void) {
+	for (;;) {
+		elect();
+		if (!memcmp(world->magic, Magic, sizeof(Magic))) {
+			for (uint i = 0; i < PlayersCap; ++i) {
+				struct Player *player = &world->players[i];
+				if (player->state != Free) continue;
+				player->seen = world->tick;
+				uint expected = Free;
+				if (
+					atomic_compare_exchange_strong(
+						&player->state, &expected, Joining
+					)
+				) return player;
+			}
+			return NULL;
+		}
+		usleep(TickUsec);
+	}
+}
+
+static void curse(void) {
+	noecho();
+	curs_set(0);
+	keypad(stdscr, true);
+	init_pair(1, COLOR_GREEN, -1);
+	init_pair(2, COLOR_YELLOW, -1);
+	init_pair(3, COLOR_RED, -1);
+	init_pair(4, COLOR_CYAN, -1);
+}
+
+static int origin(int head, int view, int size) {
+	if (view >= size) return (size - view) / 2;
+	int top = head - view / 2;
+	if (top < 0) return 0;
+	if (top > size - view) return size - view;
+	return top;
+}
+
+static void draw(const struct Session *session) {
+	const struct Player *me = session->me;
+	const char *over = (session->over ? Reasons[session->reason] : NULL);
+	if (!me) {
+		attr_set(A_NORMAL, 0, NULL);
+		mvaddstr(0, 0, over);
+		mvaddstr(LINES - 1, 0, "Press any key to view the scoreboard.");
+		return;
+	}
+	uint index = me - world->players;
+	uint alive = 0;
+	for (uint i = 0; i < PlayersCap; ++i) {
+		if (world->players[i].state == Alive) alive++;
+	}
+	attr_set(A_NORMAL, 0, NULL);
+	mvprintw(
+		0, 0, "Score %u  Length %u  Players %u  %s",
+		me->score, me->len, alive, (over ? over : "")
+	);
+	clrtoeol();
+
+	int rows = LINES - 1, cols = COLS;
+	uint head = me->head;
+	int top = origin(head / Cols, rows, Rows);
+	int left = origin(head % Cols, cols, Cols);
+	for (int y = 0; y < rows; ++y) {
+		move(1 + y, 0);
+		for (int x = 0; x < cols; ++x) {
+			int ay = top + y, ax = left + x;
+			if (ay < 0 || ax < 0 || ay >= Rows || ax >= Cols) {
+				addch(ACS_CKBOARD);
+				continue;
+			}
+			uint16_t c = session->cells[ay * Cols + ax];
+			uint data = cellData(c);
+			switch (cellKind(c)) {
+				break; case Empty: addch(' ');
+				break; case Food: {
+					uint64_t age = session->cellsTick
+						- world->food[data].born;
+					if (age > FoodSpoil) {
+						addch('*' | COLOR_PAIR(3));
+					} else if (age > FoodRipe) {
+						addch('%' | COLOR_PAIR(2));
+					} else {
+						addch('&' | COLOR_PAIR(1));
+					}
+				}
+				break; case Body: {
+					addch('#' | COLOR_PAIR(data == index ? 2 : 4));
+				}
+				break; case Head: {
+					addch('@' | A_BOLD | COLOR_PAIR(data == index ? 0 : 4));
+				}
+			}
+		}
+	}
+	if (session->over) {
+		mvaddstr(LINES - 1, 0, "Press any key to view the scoreboard.");
+	}
+}
+
+static void sessionInit(void *ptr, struct Rng *rng) {
+	(void)rng;
+	struct Session *session = ptr;
+	if (!world) errx(EX_SOFTWARE, "arena not prepared");
+	signal(SIGTSTP, SIG_IGN);
+	session->me = join();
+	if (!session->me) {
+		session->over = true;
+		session->reason = Full;
+		return;
+	}
+	resync(session);
+}
+
+static uint sessionStep(void *ptr, int key, struct Rng *rng) {
+	(void)rng;
+	struct Session *session = ptr;
+	struct Player *me = session->me;
+	if (session->over) {
+		if (
+			key == Tick || key == KEY_LEFT || key == KEY_DOWN ||
+			key == KEY_UP || key == KEY_RIGHT
+		) return 0;
+		return EventDone;
+	}
+	switch (key) {
+		break; case 'h': case KEY_LEFT:  me->input = 0;
+		break; case 'j': case KEY_DOWN:  me->input = 1;
+		break; case 'k': case KEY_UP:    me->input = 2;
+		break; case 'l': case KEY_RIGHT: me->input = 3;
+		break; case 'q': me->input = Quit;
+	}
+	if (key != Tick) return 0;
+	elect();
+	uint64_t drawn = session->cellsTick;
+	update(session);
+	me->seen = session->cellsTick;
+	uint state = me->state;
+	if (state == Corpse || state == Dead) {
+		session->score = me->score;
+		session->reason = me->reason;
+		session->over = true;
+		update(session);
+		me->input = Gone;
+		return DirtyAll | EventOver;
+	}
+	if (state == Alive && session->cellsTick != drawn) return DirtyAll;
+	return 0;
+}
+
+static int sessionDelay(const void *ptr) {
+	const struct Session *session = ptr;
+	return (session->over ? Forever : FrameUsec / 1000);
+}
+
+static void sessionRender(const void *ptr, uint dirty) {
+	if (dirty) draw(ptr);
+}
+
+static uint sessionScore(const void *ptr) {
+	const struct Session *session = ptr;
+	return session->score;
+}
+
+// Sessions share a live world, so there's nothing of their own to save.
+const struct Engine EngineArena = {
+	.size = sizeof(struct Session),
+	.curse = curse,
+	.init = sessionInit,
+	.step = sessionStep,
+	.delay = sessionDelay,
+	.render = sessionRender,
+	.score = sessionScore,
+};
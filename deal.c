@@ -0,0 +1,47 @@
+/* Copyright (C) 2019, 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "play.h"
+
+// https://rosettacode.org/wiki/Deal_cards_for_FreeCell
+static uint lcg(uint *state) {
+	*state = (214013 * *state + 2531011) % (1 << 31);
+	return *state >> 16;
+}
+
+void deal(struct Stack stacks[static Stacks], uint game) {
+	uint state = game;
+	struct Stack deck = {0};
+	for (Card i = A; i <= K; ++i) {
+		deck.cards[deck.len++] = Club | i;
+		deck.cards[deck.len++] = Diamond | i;
+		deck.cards[deck.len++] = Heart | i;
+		deck.cards[deck.len++] = Spade | i;
+	}
+	for (uint i = 0; i < Stacks; ++i) {
+		stacks[i].len = 0;
+	}
+	for (uint stack = 0; deck.len; ++stack) {
+		uint i = lcg(&state) % deck.len;
+		Card card = deck.cards[i];
+		deck.cards[i] = deck.cards[--deck.len];
+		struct Stack *dst = &stacks[Tableau + stack%8];
+		dst->cards[dst->len++] = card;
+	}
+}
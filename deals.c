@@ -0,0 +1,125 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+static struct {
+	uint cap;
+	atomic_uint next;
+	atomic_uint solved;
+	atomic_uint unsolvable;
+	struct Deals deals;
+} batch;
+
+enum { Batch = 64 };
+
+static void *work(void *ptr) {
+	(void)ptr;
+	struct Solution *solution = malloc(sizeof(*solution));
+	if (!solution) err(EX_OSERR, "malloc");
+	for (uint base; (base = atomic_fetch_add(&batch.next, Batch)) < Deals;) {
+		uint end = (Deals - base < Batch ? Deals : base + Batch);
+		for (uint i = base; i < end; ++i) {
+			struct Stack stacks[Stacks];
+			deal(stacks, 1 + i);
+			byte difficulty = DealUnknown;
+			switch (solve(solution, stacks, 0, batch.cap)) {
+				break; case Solved: {
+					double log = log2(1 + solution->nodes);
+					difficulty = (log < 21 ? 12 * log : DealUnknown - 1);
+					batch.solved++;
+				}
+				break; case Unsolvable: batch.unsolvable++;
+				break; case GaveUp:;
+			}
+			batch.deals.difficulty[i] = difficulty;
+		}
+	}
+	free(solution);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = "freecell.deals";
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	batch.cap = 1 << 18;
+	for (int opt; 0 < (opt = getopt(argc, argv, "c:j:o:"));) {
+		switch (opt) {
+			break; case 'c': batch.cap = strtoul(optarg, NULL, 10);
+			break; case 'j': threads = strtol(optarg, NULL, 10);
+			break; case 'o': path = optarg;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (!batch.cap) errx(EX_USAGE, "no node cap");
+	if (threads < 1) threads = 1;
+
+	pthread_t *thread = calloc(threads, sizeof(*thread));
+	if (!thread) err(EX_OSERR, "calloc");
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < threads; ++i) {
+		int error = pthread_create(&thread[i], NULL, work, NULL);
+		if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+	}
+	for (long i = 0; i < threads; ++i) {
+		pthread_join(thread[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	memcpy(batch.deals.magic, DealsMagic, sizeof(DealsMagic));
+	uint levels[8] = {0};
+	for (uint i = 0; i < Deals; ++i) {
+		byte difficulty = batch.deals.difficulty[i];
+		if (difficulty == DealUnknown) continue;
+		batch.deals.solvable[i / 8] |= 1 << (i % 8);
+		levels[difficulty * 8 / DealUnknown]++;
+	}
+	uint solved = batch.solved, unsolvable = batch.unsolvable;
+	printf(
+		"deals %u solved %u unsolvable %u unknown %u threads %ld\n",
+		Deals, solved, unsolvable, Deals - solved - unsolvable, threads
+	);
+	for (uint i = 0; i < Deals; ++i) {
+		if (batch.deals.difficulty[i] != DealUnknown) continue;
+		printf("unsolved #%u\n", 1 + i);
+	}
+	for (uint i = 0; i < ARRAY_LEN(levels); ++i) {
+		printf(
+			"difficulty %3u-%3u deals %u\n",
+			i * DealUnknown / 8, (i + 1) * DealUnknown / 8 - 1, levels[i]
+		);
+	}
+	printf("elapsed %.3f deals/s %.1f\n", elapsed, Deals / elapsed);
+
+	FILE *file = fopen(path, "w");
+	if (!file) err(EX_CANTCREAT, "%s", path);
+	fwrite(&batch.deals, sizeof(batch.deals), 1, file);
+	if (ferror(file) || fclose(file)) err(EX_IOERR, "%s", path);
+}
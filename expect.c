@@ -0,0 +1,258 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Expectimax over spawn outcomes, 90% 2 and 10% 4 as in 2048.c spawn().
+// The root is split into one task per (move, empty cell, tile) and the
+// tasks are shared out to worker threads, deepening until the budget
+// runs out. The deepest fully searched depth decides the move.
+
+enum {
+	DepthMax = 8,
+	WorkersCap = 16,
+	TableBits = 16,
+	TasksCap = Dirs * 16 * 2,
+};
+static const float ProbMin = 0.0001;
+
+static float rowHeur[1 << 16];
+
+// Weights from nneonneo's 2048-ai.
+static void heurInit(void) {
+	for (uint row = 0; row < ARRAY_LEN(rowHeur); ++row) {
+		uint cells[4];
+		for (uint x = 0; x < 4; ++x) {
+			cells[x] = row >> (4 * x) & 0xF;
+		}
+		float sum = 0;
+		uint empty = 0, merges = 0, prev = 0, run = 0;
+		for (uint x = 0; x < 4; ++x) {
+			sum += powf(cells[x], 3.5);
+			if (!cells[x]) {
+				empty++;
+				continue;
+			}
+			if (prev == cells[x]) {
+				run++;
+			} else {
+				if (run) merges += 1 + run;
+				run = 0;
+				prev = cells[x];
+			}
+		}
+		if (run) merges += 1 + run;
+		float monoL = 0, monoR = 0;
+		for (uint x = 1; x < 4; ++x) {
+			float a = powf(cells[x - 1], 4), b = powf(cells[x], 4);
+			if (cells[x - 1] > cells[x]) {
+				monoL += a - b;
+			} else {
+				monoR += b - a;
+			}
+		}
+		rowHeur[row] = 200000 + 270 * empty + 700 * merges
+			- 47 * fminf(monoL, monoR) - 11 * sum;
+	}
+}
+
+static float heuristic(Grid grid) {
+	Grid cols = gridTranspose(grid);
+	float value = 0;
+	for (uint i = 0; i < 4; ++i) {
+		value += rowHeur[(uint16_t)(grid >> (16 * i))];
+		value += rowHeur[(uint16_t)(cols >> (16 * i))];
+	}
+	return value;
+}
+
+struct Entry {
+	Grid grid;
+	float value;
+	uint depth;
+};
+
+struct Task {
+	enum Dir dir;
+	Grid grid;
+	float weight;
+	float value;
+};
+
+static struct {
+	struct Task tasks[TasksCap];
+	uint len;
+	atomic_uint next;
+	atomic_bool expired;
+	struct timespec deadline;
+} search;
+
+static struct Worker {
+	pthread_t thread;
+	struct Entry *table;
+	uint64_t nodes;
+} workers[WorkersCap];
+static uint workersLen;
+
+static bool expired(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < search.deadline.tv_sec) return false;
+	if (now.tv_sec > search.deadline.tv_sec) return true;
+	return now.tv_nsec >= search.deadline.tv_nsec;
+}
+
+static float chance(struct Worker *worker, Grid grid, uint depth, float prob);
+
+static float maxNode(struct Worker *worker, Grid grid, uint depth, float prob) {
+	float best = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		Grid next = gridMove(grid, dir, NULL);
+		if (next == grid) continue;
+		float value = chance(worker, next, depth, prob);
+		if (value > best) best = value;
+	}
+	return best;
+}
+
+static float chance(struct Worker *worker, Grid grid, uint depth, float prob) {
+	if (!depth || prob < ProbMin) return heuristic(grid);
+	if (!(++worker->nodes & 0x3FF) && expired()) search.expired = true;
+	if (search.expired) return 0;
+
+	struct Entry *entry = &worker->table[
+		(grid * 0x9E3779B97F4A7C15) >> (64 - TableBits)
+	];
+	if (entry->grid == grid && entry->depth >= depth) return entry->value;
+
+	Grid mask = gridEmptyMask(grid);
+	uint empty = __builtin_popcountll(mask);
+	prob /= empty;
+	float sum = 0;
+	for (; mask; mask &= mask - 1) {
+		Grid tile = mask & -mask;
+		sum += 0.9 * maxNode(worker, grid | tile, depth - 1, prob * 0.9);
+		sum += 0.1 * maxNode(worker, grid | tile << 1, depth - 1, prob * 0.1);
+	}
+	float value = sum / empty;
+	if (search.expired) return 0;
+	*entry = (struct Entry) { grid, value, depth };
+	return value;
+}
+
+static uint taskDepth;
+static void *work(void *ptr) {
+	struct Worker *worker = ptr;
+	for (uint i; (i = search.next++) < search.len;) {
+		struct Task *task = &search.tasks[i];
+		task->value = maxNode(worker, task->grid, taskDepth - 1, 1);
+	}
+	return NULL;
+}
+
+static void init(void) {
+	if (workersLen) return;
+	gridInit();
+	heurInit();
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	workersLen = (n < 1 ? 1 : n > WorkersCap ? WorkersCap : n);
+	for (uint i = 0; i < workersLen; ++i) {
+		workers[i].table = calloc(1 << TableBits, sizeof(struct Entry));
+		if (!workers[i].table) err(EX_OSERR, "calloc");
+	}
+}
+
+bool hintsOff;
+
+struct Hint gridHint(Grid grid, uint budget) {
+	struct Hint hint = { .dir = Dirs };
+	if (hintsOff) return hint;
+	init();
+
+	search.len = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		Grid next = gridMove(grid, dir, NULL);
+		if (next == grid) continue;
+		if (hint.dir == Dirs) hint.dir = dir;
+		Grid mask = gridEmptyMask(next);
+		float empty = __builtin_popcountll(mask);
+		for (; mask; mask &= mask - 1) {
+			Grid tile = mask & -mask;
+			search.tasks[search.len++] = (struct Task) {
+				.dir = dir, .grid = next | tile, .weight = 0.9 / empty,
+			};
+			search.tasks[search.len++] = (struct Task) {
+				.dir = dir, .grid = next | tile << 1, .weight = 0.1 / empty,
+			};
+		}
+	}
+	if (hint.dir == Dirs) return hint;
+
+	clock_gettime(CLOCK_MONOTONIC, &search.deadline);
+	search.deadline.tv_sec += budget / 1000;
+	search.deadline.tv_nsec += budget % 1000 * 1000000;
+	if (search.deadline.tv_nsec >= 1000000000) {
+		search.deadline.tv_sec++;
+		search.deadline.tv_nsec -= 1000000000;
+	}
+	search.expired = false;
+	for (uint i = 0; i < workersLen; ++i) {
+		workers[i].nodes = 0;
+	}
+
+	for (taskDepth = 1; taskDepth <= DepthMax; ++taskDepth) {
+		search.next = 0;
+		for (uint i = 1; i < workersLen; ++i) {
+			int error = pthread_create(
+				&workers[i].thread, NULL, work, &workers[i]
+			);
+			if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+		}
+		work(&workers[0]);
+		for (uint i = 1; i < workersLen; ++i) {
+			pthread_join(workers[i].thread, NULL);
+		}
+		if (search.expired) break;
+
+		float values[Dirs] = {0};
+		for (uint i = 0; i < search.len; ++i) {
+			struct Task task = search.tasks[i];
+			values[task.dir] += task.weight * task.value;
+		}
+		for (enum Dir dir = Left; dir < Dirs; ++dir) {
+			if (values[dir] > values[hint.dir]) hint.dir = dir;
+		}
+		hint.depth = taskDepth;
+		if (expired()) break;
+	}
+
+	for (uint i = 0; i < workersLen; ++i) {
+		hint.nodes += workers[i].nodes;
+	}
+	return hint;
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// The file is opened up front, since a session may have given up the
+// right to create files by the time it needs to dump.
+static int flightFD = -1;
+static struct {
+	struct FlightHead head;
+	struct Flight ring[FlightLen];
+} flight;
+static uint64_t flightCount;
+static struct Flight dump[FlightLen];
+
+void flightOpen(const char *path, const char *game) {
+	flightFD = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	memcpy(flight.head.magic, FlightMagic, sizeof(FlightMagic));
+	flight.head.pid = getpid();
+	strncpy(flight.head.game, game, sizeof(flight.head.game) - 1);
+}
+
+void flightRecord(enum FlightType type, uint32_t arg) {
+	if (flightFD < 0) return;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct Flight *event = &flight.ring[flightCount++ % FlightLen];
+	event->usec = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	event->type = type;
+	event->arg = arg;
+}
+
+// Writes the head and then the events in order with one write, so that
+// records from concurrent sessions don't interleave.
+void flightDump(void) {
+	if (flightFD < 0 || !flightCount) return;
+	uint64_t len = (flightCount < FlightLen ? flightCount : FlightLen);
+	uint64_t first = flightCount - len;
+	for (uint64_t i = 0; i < len; ++i) {
+		dump[i] = flight.ring[(first + i) % FlightLen];
+	}
+	memcpy(flight.ring, dump, sizeof(dump[0]) * len);
+	flightCount = len;
+	flight.head.len = len;
+	flight.head.date = time(NULL);
+	ssize_t n = write(
+		flightFD, &flight, sizeof(flight.head) + sizeof(dump[0]) * len
+	);
+	(void)n;
+}
@@ -0,0 +1,128 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+static const char *Names[FlightTypes] = {
+	[FlightKey] = "key",
+	[FlightTick] = "tick",
+	[FlightTickEnd] = "tick-end",
+	[FlightDraw] = "draw",
+	[FlightFlush] = "flush",
+	[FlightSync] = "sync",
+	[FlightSyncReply] = "sync-reply",
+	[FlightLock] = "lock",
+	[FlightLocked] = "locked",
+	[FlightUnlock] = "unlock",
+};
+
+static int compare(const void *_a, const void *_b) {
+	const uint64_t *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+// Times from each event of one type to the next event of another. Frames
+// are flushes that sent any lines, and draws only count if they drew.
+static void span(
+	const char *name, const struct Flight *events, uint len,
+	enum FlightType from, enum FlightType to, bool frame
+) {
+	uint64_t times[FlightLen];
+	uint n = 0;
+	for (uint i = 0; i < len; ++i) {
+		if (events[i].type != from) continue;
+		if (from == FlightDraw && !events[i].arg) continue;
+		for (uint j = i + 1; j < len; ++j) {
+			if (events[j].type != to) continue;
+			if (frame && !events[j].arg) continue;
+			times[n++] = events[j].usec - events[i].usec;
+			break;
+		}
+	}
+	if (!n) return;
+	qsort(times, n, sizeof(times[0]), compare);
+	printf(
+		"  %-12s n %5u  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+		name, n, times[n / 2] / 1e3, times[(n - 1) * 99 / 100] / 1e3,
+		times[n - 1] / 1e3
+	);
+}
+
+int main(int argc, char *argv[]) {
+	bool verbose = false;
+	uint32_t pid = 0;
+	for (int opt; 0 < (opt = getopt(argc, argv, "p:v"));) {
+		switch (opt) {
+			break; case 'p': pid = strtoul(optarg, NULL, 10);
+			break; case 'v': verbose = true;
+			break; default:  return EX_USAGE;
+		}
+	}
+	const char *path = (optind < argc ? argv[optind] : "play.flight");
+	FILE *file = fopen(path, "r");
+	if (!file) err(EX_NOINPUT, "%s", path);
+
+	static struct Flight events[FlightLen];
+	struct FlightHead head;
+	while (fread(&head, sizeof(head), 1, file)) {
+		if (memcmp(head.magic, FlightMagic, sizeof(FlightMagic))) {
+			errx(EX_DATAERR, "%s: not a flight record", path);
+		}
+		if (head.len > FlightLen) errx(EX_DATAERR, "%s: bad length", path);
+		if (fread(events, sizeof(events[0]), head.len, file) != head.len) {
+			errx(EX_DATAERR, "%s: truncated record", path);
+		}
+		if (pid && head.pid != pid) continue;
+
+		char date[32];
+		time_t t = head.date;
+		strftime(date, sizeof(date), "%F %T", localtime(&t));
+		head.game[sizeof(head.game) - 1] = '\0';
+		uint64_t start = (head.len ? events[0].usec : 0);
+		uint64_t end = (head.len ? events[head.len - 1].usec : 0);
+		printf(
+			"pid %" PRIu32 " %s %s events %" PRIu32 " over %.3f s\n",
+			head.pid, head.game, date, head.len, (end - start) / 1e6
+		);
+		span("key-frame", events, head.len, FlightKey, FlightFlush, true);
+		span("tick-frame", events, head.len, FlightTick, FlightFlush, true);
+		span("tick-step", events, head.len, FlightTick, FlightTickEnd, false);
+		span("draw-flush", events, head.len, FlightDraw, FlightFlush, false);
+		span("sync", events, head.len, FlightSync, FlightSyncReply, false);
+		span("lock-wait", events, head.len, FlightLock, FlightLocked, false);
+		span("lock-hold", events, head.len, FlightLocked, FlightUnlock, false);
+		if (!verbose) continue;
+		for (uint i = 0; i < head.len; ++i) {
+			uint32_t type = events[i].type;
+			printf(
+				"  %+12.3f ms %-10s %" PRIu32 "\n",
+				(events[i].usec - start) / 1e3,
+				(type < FlightTypes ? Names[type] : "?"), events[i].arg
+			);
+		}
+	}
+	if (ferror(file)) err(EX_IOERR, "%s", path);
+}
@@ -0,0 +1,848 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// For the wide character functions of curses and wcwidth.
+#define _XOPEN_SOURCE_EXTENDED
+#define _GNU_SOURCE
+
+#include <curses.h>
+#include <err.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <termios.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "play.h"
+
+// Draws scripted games and scoreboards with the real render functions into
+// curses, and feeds the bytes it sends to an xterm kept in memory. Each
+// frame's bytes and changed cells are counted, and the emulated screen is
+// checked against what curses was asked to draw. A hash of every frame's
+// screen lets a baseline tell a change in what is drawn from a change in
+// how it is sent.
+
+enum { Rows = 24, Cols = 80 };
+
+enum {
+	AttrBold = 1 << 0,
+	AttrDim = 1 << 1,
+	AttrItalic = 1 << 2,
+	AttrUnder = 1 << 3,
+	AttrBlink = 1 << 4,
+	AttrReverse = 1 << 5,
+	AttrInvis = 1 << 6,
+};
+
+enum { DefaultFg = -1, DefaultBg = -2 };
+
+// A ch of 0 is the right half of a wide character.
+struct Cell {
+	uint32_t ch;
+	uint8_t attr;
+	short fg, bg;
+};
+
+enum State { Ground, Escape, EscapeInter, CSI, OSC, OSCEscape };
+
+static struct {
+	struct Cell cells[Rows][Cols];
+	int y, x;
+	bool wrap;
+	struct Cell pen;
+	int top, bot;
+	bool graphics;
+	uint32_t last;
+	struct {
+		int y, x;
+		struct Cell pen;
+		bool graphics;
+	} saved;
+	enum State state;
+	char inter, priv;
+	int params[16];
+	uint paramsLen;
+	uint32_t utf;
+	uint utfLeft;
+	uint unknown;
+} vt;
+
+// The DEC special graphics set, from 0x5F.
+static const uint32_t Graphics[] = {
+	0x0020, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,
+	0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,
+	0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,
+	0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7,
+};
+
+static uint32_t graphic(uint32_t ch) {
+	return (ch >= 0x5F && ch <= 0x7E ? Graphics[ch - 0x5F] : ch);
+}
+
+// Erased cells take the current background, as on a terminal with bce.
+static struct Cell blank(void) {
+	return (struct Cell) { ' ', 0, DefaultFg, vt.pen.bg };
+}
+
+static void vtReset(void) {
+	memset(&vt, 0, sizeof(vt));
+	vt.pen = (struct Cell) { ' ', 0, DefaultFg, DefaultBg };
+	vt.bot = Rows - 1;
+	for (int y = 0; y < Rows; ++y) {
+		for (int x = 0; x < Cols; ++x) {
+			vt.cells[y][x] = blank();
+		}
+	}
+	vt.saved.pen = vt.pen;
+}
+
+static void clearCells(int y, int x0, int x1) {
+	for (int x = x0; x < x1 && x < Cols; ++x) {
+		vt.cells[y][x] = blank();
+	}
+}
+
+// Moves rows [top, bot] up by n, or down for negative n.
+static void scrollRows(int top, int bot, int n) {
+	int len = bot - top + 1;
+	if (n > len) n = len;
+	if (n < -len) n = -len;
+	if (n > 0) {
+		memmove(
+			vt.cells[top], vt.cells[top + n],
+			sizeof(vt.cells[0]) * (len - n)
+		);
+		for (int y = bot - n + 1; y <= bot; ++y) clearCells(y, 0, Cols);
+	} else if (n < 0) {
+		n = -n;
+		memmove(
+			vt.cells[top + n], vt.cells[top],
+			sizeof(vt.cells[0]) * (len - n)
+		);
+		for (int y = top; y < top + n; ++y) clearCells(y, 0, Cols);
+	}
+}
+
+static void lineFeed(void) {
+	if (vt.y == vt.bot) {
+		scrollRows(vt.top, vt.bot, 1);
+	} else if (vt.y + 1 < Rows) {
+		vt.y++;
+	}
+}
+
+static void print(uint32_t ch) {
+	if (vt.graphics) ch = graphic(ch);
+	int width = wcwidth(ch);
+	if (!width) return;
+	if (width < 0) width = 1;
+	if (vt.wrap) {
+		vt.x = 0;
+		lineFeed();
+		vt.wrap = false;
+	}
+	if (width == 2 && vt.x == Cols - 1) {
+		clearCells(vt.y, vt.x, Cols);
+		vt.x = 0;
+		lineFeed();
+	}
+	struct Cell cell = vt.pen;
+	cell.ch = ch;
+	vt.cells[vt.y][vt.x] = cell;
+	if (width == 2) {
+		cell.ch = 0;
+		vt.cells[vt.y][vt.x + 1] = cell;
+	}
+	vt.x += width;
+	if (vt.x >= Cols) {
+		vt.x = Cols - 1;
+		vt.wrap = true;
+	}
+	vt.last = ch;
+}
+
+static int param(uint i, int def) {
+	return (i < vt.paramsLen && vt.params[i] ? vt.params[i] : def);
+}
+
+static int clamp(int n, int lo, int hi) {
+	return (n < lo ? lo : n > hi ? hi : n);
+}
+
+static void sgr(void) {
+	if (!vt.paramsLen) vt.paramsLen = 1;
+	for (uint i = 0; i < vt.paramsLen; ++i) {
+		int p = vt.params[i];
+		switch (p) {
+			break; case 0: {
+				vt.pen.attr = 0;
+				vt.pen.fg = DefaultFg;
+				vt.pen.bg = DefaultBg;
+			}
+			break; case 1: vt.pen.attr |= AttrBold;
+			break; case 2: vt.pen.attr |= AttrDim;
+			break; case 3: vt.pen.attr |= AttrItalic;
+			break; case 4: vt.pen.attr |= AttrUnder;
+			break; case 5: vt.pen.attr |= AttrBlink;
+			break; case 7: vt.pen.attr |= AttrReverse;
+			break; case 8: vt.pen.attr |= AttrInvis;
+			break; case 22: vt.pen.attr &= ~(AttrBold | AttrDim);
+			break; case 23: vt.pen.attr &= ~AttrItalic;
+			break; case 24: vt.pen.attr &= ~AttrUnder;
+			break; case 25: vt.pen.attr &= ~AttrBlink;
+			break; case 27: vt.pen.attr &= ~AttrReverse;
+			break; case 28: vt.pen.attr &= ~AttrInvis;
+			break; case 30 ... 37: vt.pen.fg = p - 30;
+			break; case 39: vt.pen.fg = DefaultFg;
+			break; case 40 ... 47: vt.pen.bg = p - 40;
+			break; case 49: vt.pen.bg = DefaultBg;
+			break; case 90 ... 97: vt.pen.fg = 8 + p - 90;
+			break; case 100 ... 107: vt.pen.bg = 8 + p - 100;
+			break; case 38: case 48: {
+				short color = -1;
+				if (i + 2 < vt.paramsLen && vt.params[i + 1] == 5) {
+					color = vt.params[i + 2];
+					i += 2;
+				} else {
+					vt.unknown++;
+					i = vt.paramsLen;
+				}
+				if (color < 0) break;
+				if (p == 38) vt.pen.fg = color;
+				if (p == 48) vt.pen.bg = color;
+			}
+			break; default: vt.unknown++;
+		}
+	}
+}
+
+static void csi(char final) {
+	int n = param(0, 1);
+	if (vt.priv || vt.inter) {
+		// Private modes, such as the alternate screen, cursor visibility
+		// and keypad transmit, don't change what the screen shows.
+		if (final != 'h' && final != 'l') vt.unknown++;
+		return;
+	}
+	if (final != 'b') vt.wrap = false;
+	switch (final) {
+		break; case 'A': {
+			vt.y = clamp(vt.y - n, (vt.y >= vt.top ? vt.top : 0), Rows - 1);
+		}
+		break; case 'B': case 'e': {
+			vt.y = clamp(vt.y + n, 0, (vt.y <= vt.bot ? vt.bot : Rows - 1));
+		}
+		break; case 'C': case 'a': vt.x = clamp(vt.x + n, 0, Cols - 1);
+		break; case 'D': vt.x = clamp(vt.x - n, 0, Cols - 1);
+		break; case 'E': case 'F': {
+			int dy = (final == 'E' ? n : -n);
+			vt.y = clamp(vt.y + dy, vt.top, vt.bot);
+			vt.x = 0;
+		}
+		break; case 'G': case '`': vt.x = clamp(n - 1, 0, Cols - 1);
+		break; case 'd': vt.y = clamp(n - 1, 0, Rows - 1);
+		break; case 'H': case 'f': {
+			vt.y = clamp(n - 1, 0, Rows - 1);
+			vt.x = clamp(param(1, 1) - 1, 0, Cols - 1);
+		}
+		break; case 'J': {
+			int mode = param(0, 0);
+			if (mode == 0) {
+				clearCells(vt.y, vt.x, Cols);
+				for (int y = vt.y + 1; y < Rows; ++y) clearCells(y, 0, Cols);
+			} else if (mode == 1) {
+				for (int y = 0; y < vt.y; ++y) clearCells(y, 0, Cols);
+				clearCells(vt.y, 0, vt.x + 1);
+			} else {
+				for (int y = 0; y < Rows; ++y) clearCells(y, 0, Cols);
+			}
+		}
+		break; case 'K': {
+			int mode = param(0, 0);
+			if (mode == 0) clearCells(vt.y, vt.x, Cols);
+			if (mode == 1) clearCells(vt.y, 0, vt.x + 1);
+			if (mode == 2) clearCells(vt.y, 0, Cols);
+		}
+		break; case 'X': clearCells(vt.y, vt.x, vt.x + n);
+		break; case '@': {
+			struct Cell *row = vt.cells[vt.y];
+			n = clamp(n, 0, Cols - vt.x);
+			memmove(
+				&row[vt.x + n], &row[vt.x],
+				sizeof(*row) * (Cols - vt.x - n)
+			);
+			clearCells(vt.y, vt.x, vt.x + n);
+		}
+		break; case 'P': {
+			struct Cell *row = vt.cells[vt.y];
+			n = clamp(n, 0, Cols - vt.x);
+			memmove(
+				&row[vt.x], &row[vt.x + n],
+				sizeof(*row) * (Cols - vt.x - n)
+			);
+			clearCells(vt.y, Cols - n, Cols);
+		}
+		break; case 'L': {
+			if (vt.y >= vt.top && vt.y <= vt.bot) scrollRows(vt.y, vt.bot, -n);
+			vt.x = 0;
+		}
+		break; case 'M': {
+			if (vt.y >= vt.top && vt.y <= vt.bot) scrollRows(vt.y, vt.bot, n);
+			vt.x = 0;
+		}
+		break; case 'S': scrollRows(vt.top, vt.bot, n);
+		break; case 'T': scrollRows(vt.top, vt.bot, -n);
+		break; case 'b': {
+			for (int i = 0; i < n && vt.last; ++i) {
+				bool graphics = vt.graphics;
+				vt.graphics = false;
+				print(vt.last);
+				vt.graphics = graphics;
+			}
+		}
+		break; case 'm': sgr();
+		break; case 'r': {
+			vt.top = clamp(param(0, 1) - 1, 0, Rows - 1);
+			vt.bot = clamp(param(1, Rows) - 1, vt.top, Rows - 1);
+			vt.y = vt.x = 0;
+		}
+		break; case 's': {
+			vt.saved.y = vt.y;
+			vt.saved.x = vt.x;
+		}
+		break; case 'u': {
+			vt.y = vt.saved.y;
+			vt.x = vt.saved.x;
+		}
+		break; case 'h': case 'l': case 'n': case 't': case 'c':;
+		break; default: vt.unknown++;
+	}
+}
+
+static void escape(char final) {
+	switch (vt.inter) {
+		break; case '(': vt.graphics = (final == '0');
+		break; case ')': case '*': case '+': case '#': case ' ':;
+		break; default: {
+			switch (final) {
+				break; case '7': {
+					vt.saved.y = vt.y;
+					vt.saved.x = vt.x;
+					vt.saved.pen = vt.pen;
+					vt.saved.graphics = vt.graphics;
+				}
+				break; case '8': {
+					vt.y = vt.saved.y;
+					vt.x = vt.saved.x;
+					vt.pen = vt.saved.pen;
+					vt.graphics = vt.saved.graphics;
+					vt.wrap = false;
+				}
+				break; case 'D': lineFeed();
+				break; case 'E': {
+					vt.x = 0;
+					lineFeed();
+				}
+				break; case 'M': {
+					if (vt.y == vt.top) {
+						scrollRows(vt.top, vt.bot, -1);
+					} else if (vt.y) {
+						vt.y--;
+					}
+				}
+				break; case 'c': vtReset();
+				break; case '=': case '>':;
+				break; default: vt.unknown++;
+			}
+		}
+	}
+}
+
+static void control(byte ch) {
+	switch (ch) {
+		break; case '\r': {
+			vt.x = 0;
+			vt.wrap = false;
+		}
+		break; case '\n': case '\v': case '\f': lineFeed();
+		break; case '\b': {
+			if (vt.x) vt.x--;
+			vt.wrap = false;
+		}
+		break; case '\t': vt.x = clamp((vt.x / 8 + 1) * 8, 0, Cols - 1);
+		break; case '\a': case 0x0E: case 0x0F:;
+		break; case '\33': {
+			vt.state = Escape;
+			vt.inter = 0;
+		}
+		break; default: vt.unknown++;
+	}
+}
+
+static void feed(byte ch) {
+	switch (vt.state) {
+		break; case Ground: {
+			if (vt.utfLeft && (ch & 0xC0) == 0x80) {
+				vt.utf = vt.utf << 6 | (ch & 0x3F);
+				if (!--vt.utfLeft) print(vt.utf);
+			} else if (ch < 0x20 || ch == 0x7F) {
+				vt.utfLeft = 0;
+				if (ch != 0x7F) control(ch);
+			} else if (ch < 0x80) {
+				vt.utfLeft = 0;
+				print(ch);
+			} else if ((ch & 0xE0) == 0xC0) {
+				vt.utf = ch & 0x1F;
+				vt.utfLeft = 1;
+			} else if ((ch & 0xF0) == 0xE0) {
+				vt.utf = ch & 0x0F;
+				vt.utfLeft = 2;
+			} else if ((ch & 0xF8) == 0xF0) {
+				vt.utf = ch & 0x07;
+				vt.utfLeft = 3;
+			} else {
+				vt.unknown++;
+			}
+		}
+		break; case Escape: case EscapeInter: {
+			if (ch == '[' && vt.state == Escape) {
+				vt.state = CSI;
+				vt.priv = vt.inter = 0;
+				vt.paramsLen = 0;
+				memset(vt.params, 0, sizeof(vt.params));
+			} else if (ch == ']' && vt.state == Escape) {
+				vt.state = OSC;
+			} else if (ch >= 0x20 && ch < 0x30) {
+				vt.inter = ch;
+				vt.state = EscapeInter;
+			} else {
+				vt.state = Ground;
+				escape(ch);
+			}
+		}
+		break; case CSI: {
+			if (ch >= '0' && ch <= '9') {
+				if (!vt.paramsLen) vt.paramsLen = 1;
+				int *p = &vt.params[vt.paramsLen - 1];
+				*p = *p * 10 + (ch - '0');
+			} else if (ch == ';') {
+				if (!vt.paramsLen) vt.paramsLen = 1;
+				if (vt.paramsLen < ARRAY_LEN(vt.params)) vt.paramsLen++;
+			} else if (ch >= '<' && ch <= '?') {
+				vt.priv = ch;
+			} else if (ch >= 0x20 && ch < 0x30) {
+				vt.inter = ch;
+			} else if (ch >= 0x40 && ch <= 0x7E) {
+				vt.state = Ground;
+				csi(ch);
+			} else {
+				vt.state = Ground;
+				vt.unknown++;
+			}
+		}
+		break; case OSC: {
+			if (ch == '\a') vt.state = Ground;
+			if (ch == '\33') vt.state = OSCEscape;
+		}
+		break; case OSCEscape: vt.state = (ch == '\\' ? Ground : OSC);
+	}
+}
+
+// How a cell looks, so that cells which look the same compare equal.
+static struct Cell visible(struct Cell cell) {
+	if (cell.fg < 0) cell.fg = DefaultFg;
+	if (cell.bg < 0) cell.bg = DefaultBg;
+	if (cell.attr & AttrReverse) {
+		short fg = cell.fg;
+		cell.fg = cell.bg;
+		cell.bg = fg;
+		cell.attr &= ~AttrReverse;
+	}
+	if (cell.attr & AttrInvis) cell.ch = ' ';
+	if (cell.ch == ' ' && !(cell.attr & AttrUnder)) {
+		cell.attr = 0;
+		cell.fg = 0;
+	}
+	return cell;
+}
+
+static struct Cell cursesCell(int y, int x) {
+	cchar_t cc;
+	wchar_t wch[CCHARW_MAX + 1] = {0};
+	attr_t attrs = 0;
+	short pair = 0;
+	mvwin_wch(stdscr, y, x, &cc);
+	getcchar(&cc, wch, &attrs, &pair, NULL);
+	struct Cell cell = { .ch = wch[0] };
+	if (attrs & A_ALTCHARSET) cell.ch = graphic(cell.ch);
+	if (attrs & A_BOLD) cell.attr |= AttrBold;
+	if (attrs & A_DIM) cell.attr |= AttrDim;
+	if (attrs & A_ITALIC) cell.attr |= AttrItalic;
+	if (attrs & A_UNDERLINE) cell.attr |= AttrUnder;
+	if (attrs & A_BLINK) cell.attr |= AttrBlink;
+	if (attrs & (A_REVERSE | A_STANDOUT)) cell.attr |= AttrReverse;
+	if (attrs & A_INVIS) cell.attr |= AttrInvis;
+	pair_content(pair, &cell.fg, &cell.bg);
+	return cell;
+}
+
+static bool same(struct Cell a, struct Cell b) {
+	a = visible(a);
+	b = visible(b);
+	return a.ch == b.ch && a.attr == b.attr && a.fg == b.fg && a.bg == b.bg;
+}
+
+static uint64_t hashCell(uint64_t hash, struct Cell cell) {
+	cell = visible(cell);
+	uint64_t values[] = {
+		cell.ch, cell.attr, (uint16_t)cell.fg, (uint16_t)cell.bg,
+	};
+	for (uint i = 0; i < ARRAY_LEN(values); ++i) {
+		for (uint j = 0; j < 4; ++j) {
+			hash ^= values[i] >> (8 * j) & 0xFF;
+			hash *= 0x100000001B3;
+		}
+	}
+	return hash;
+}
+
+static struct {
+	bool verbose;
+	bool screens;
+} opts;
+
+static struct Run {
+	char name[64];
+	SCREEN *screen;
+	FILE *out, *in;
+	off_t offset;
+	struct Cell prev[Rows][Cols];
+	uint64_t frames, bytes, maxBytes, cells, hash;
+	uint64_t mismatches;
+	int mismatchY, mismatchX;
+	uint64_t mismatchFrame;
+} run;
+
+static void runStart(const char *name) {
+	snprintf(run.name, sizeof(run.name), "%s", name);
+	run.out = tmpfile();
+	run.in = fopen("/dev/null", "r");
+	if (!run.out || !run.in) err(EX_OSERR, "tmpfile");
+	run.screen = newterm("xterm", run.out, run.in);
+	if (!run.screen) errx(EX_CONFIG, "newterm");
+	resizeterm(Rows, Cols);
+	start_color();
+	use_default_colors();
+	vtReset();
+	memcpy(run.prev, vt.cells, sizeof(run.prev));
+	run.offset = 0;
+	run.frames = run.bytes = run.maxBytes = run.cells = 0;
+	run.mismatches = 0;
+	run.hash = 0xCBF29CE484222325;
+}
+
+static void frame(void) {
+	refresh();
+	uint64_t bytes = 0;
+	byte buf[4096];
+	for (ssize_t n; 0 < (n = pread(
+		fileno(run.out), buf, sizeof(buf), run.offset
+	));) {
+		for (ssize_t i = 0; i < n; ++i) feed(buf[i]);
+		run.offset += n;
+		bytes += n;
+	}
+
+	uint64_t cells = 0;
+	for (int y = 0; y < Rows; ++y) {
+		for (int x = 0; x < Cols; ++x) {
+			struct Cell cell = vt.cells[y][x];
+			run.hash = hashCell(run.hash, cell);
+			if (!same(cell, run.prev[y][x])) cells++;
+			if (!cell.ch) continue;
+			if (same(cell, cursesCell(y, x))) continue;
+			if (!run.mismatches++) {
+				run.mismatchY = y;
+				run.mismatchX = x;
+				run.mismatchFrame = run.frames;
+			}
+		}
+	}
+	memcpy(run.prev, vt.cells, sizeof(run.prev));
+
+	if (opts.verbose) {
+		printf(
+			"# %s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+			run.name, run.frames, bytes, cells
+		);
+	}
+	run.frames++;
+	run.bytes += bytes;
+	run.cells += cells;
+	if (bytes > run.maxBytes) run.maxBytes = bytes;
+}
+
+static void printScreen(void) {
+	for (int y = 0; y < Rows; ++y) {
+		char line[Cols * MB_LEN_MAX + 1];
+		size_t len = 0, end = 0;
+		for (int x = 0; x < Cols; ++x) {
+			uint32_t ch = vt.cells[y][x].ch;
+			if (!ch) continue;
+			int n = wctomb(&line[len], ch);
+			if (n < 0) {
+				line[len] = '?';
+				n = 1;
+			}
+			len += n;
+			if (ch != ' ') end = len;
+		}
+		printf("# %.*s\n", (int)end, line);
+	}
+}
+
+static void runFinish(void) {
+	printf(
+		"%s\t%" PRIu64 "\t%" PRIu64 "\t%.1f\t%" PRIu64 "\t%" PRIu64
+		"\t%.1f\t%016" PRIx64 "\n",
+		run.name, run.frames, run.bytes,
+		(run.frames ? (double)run.bytes / run.frames : 0), run.maxBytes,
+		run.cells, (run.frames ? (double)run.cells / run.frames : 0),
+		run.hash
+	);
+	if (opts.screens) printScreen();
+	endwin();
+	delscreen(run.screen);
+	fclose(run.out);
+	fclose(run.in);
+}
+
+// Keys are drawn from keys, and after each one the game is ticked until
+// it waits on the player again, or ticks times.
+static const struct Script {
+	const char *name;
+	const struct Engine *engine;
+	const char *keys;
+	uint ticks;
+} Scripts[] = {
+	{ "2048", &Engine2048, "hjkl", 64 },
+	{ "2048-3x3", &Engine2048x3, "hjkl", 64 },
+	{ "2048-5x5", &Engine2048x5, "hjkl", 64 },
+	{ "2048-6x6", &Engine2048x6, "hjkl", 64 },
+	{ "2048-8x8", &Engine2048x8, "hjkl", 64 },
+	{ "snake", &EngineSnake, "hjkl", 3 },
+	{ "freecell", &EngineFreeCell, "qwerasdf1234 ", 64 },
+};
+
+enum { ScriptKeys = 300 };
+
+static void runScript(const struct Script *script) {
+	runStart(script->name);
+	const struct Engine *engine = script->engine;
+	void *state = calloc(1, engine->size);
+	if (!state) err(EX_OSERR, "calloc");
+	struct Rng rng, keys;
+	rngSeed(&rng, 1);
+	rngSeed(&keys, 2);
+	engine->curse();
+	engine->init(state, &rng);
+	engine->render(state, DirtyAll);
+	frame();
+	size_t len = strlen(script->keys);
+	for (uint i = 0; i < ScriptKeys; ++i) {
+		int key = script->keys[rngUniform(&keys, len)];
+		uint events = engine->step(state, key, &rng);
+		engine->render(state, events & DirtyAll);
+		frame();
+		if (events & EventDone) break;
+		for (uint j = 0; j < script->ticks; ++j) {
+			if (engine->delay(state) == Forever) break;
+			events = engine->step(state, Tick, &rng);
+			engine->render(state, events & DirtyAll);
+			frame();
+		}
+	}
+	if (engine->fini) engine->fini(state);
+	free(state);
+	runFinish();
+}
+
+// A full board of distinct names, drawn as a new entry would show it at
+// the top, partway down and far down the ranks, and without one.
+static void runBoards(void) {
+	runStart("scores");
+	for (uint i = 0; i < ScoresLen; ++i) {
+		scores[i].date = 1600000000 + 86400 * (i % 365);
+		scores[i].score = 10 * (ScoresLen - i);
+		scores[i].flags = (i % 3 ? ScoreVerified : 0);
+		snprintf(scores[i].name, sizeof(scores[i].name), "player%u", i);
+	}
+	static const size_t News[] = { 0, 7, 500, ScoresLen - 1, ScoresLen };
+	for (uint i = 0; i < ARRAY_LEN(News); ++i) {
+		erase();
+		boardDraw((i % 2 ? "TOP SCORES" : "WEEKLY SCORES"), News[i]);
+		frame();
+	}
+	runFinish();
+}
+
+static void runRecording(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (!file) err(EX_NOINPUT, "%s", path);
+	struct Recording rec;
+	if (!recordLoad(&rec, file)) errx(EX_DATAERR, "%s: not a recording", path);
+	fclose(file);
+	const struct Engine *engine = recordEngine(rec.head.game);
+	if (!engine) errx(EX_DATAERR, "%s: unknown game", path);
+	runStart(path);
+	void *state = calloc(1, engine->size);
+	if (!state) err(EX_OSERR, "calloc");
+	struct Rng rng;
+	if (!recordReset(&rec, engine, state, &rng)) {
+		errx(EX_DATAERR, "%s: bad save", path);
+	}
+	engine->curse();
+	engine->render(state, DirtyAll);
+	frame();
+	for (size_t i = 0; i < rec.len; ++i) {
+		uint events = engine->step(state, rec.steps[i].key, &rng);
+		engine->render(state, events & DirtyAll);
+		frame();
+		if (events & EventDone) break;
+	}
+	if (engine->fini) engine->fini(state);
+	free(state);
+	recordFree(&rec);
+	runFinish();
+}
+
+static struct Baseline {
+	char name[64];
+	uint64_t frames, bytes;
+	uint64_t hash;
+} *baseline;
+static size_t baselineLen;
+
+static void baselineRead(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (!file) err(EX_NOINPUT, "%s", path);
+	char *line = NULL;
+	size_t cap = 0;
+	while (0 < getline(&line, &cap, file)) {
+		if (line[0] == '#' || !strncmp(line, "name\t", 5)) continue;
+		struct Baseline entry;
+		int n = sscanf(
+			line, "%63[^\t]\t%" SCNu64 "\t%" SCNu64 "\t%*f\t%*u\t%*u\t%*f"
+			"\t%" SCNx64,
+			entry.name, &entry.frames, &entry.bytes, &entry.hash
+		);
+		if (n != 4) errx(EX_DATAERR, "%s: bad line: %s", path, line);
+		baseline = realloc(baseline, sizeof(*baseline) * (baselineLen + 1));
+		if (!baseline) err(EX_OSERR, "realloc");
+		baseline[baselineLen++] = entry;
+	}
+	if (ferror(file)) err(EX_IOERR, "%s", path);
+	free(line);
+	fclose(file);
+}
+
+// Returns the number of problems with the run just finished.
+static uint check(void) {
+	uint problems = 0;
+	if (run.mismatches) {
+		warnx(
+			"%s: frame %" PRIu64 ": terminal differs from curses at %d,%d"
+			" (%" PRIu64 " cells in all)",
+			run.name, run.mismatchFrame, run.mismatchY, run.mismatchX,
+			run.mismatches
+		);
+		problems++;
+	}
+	if (vt.unknown) {
+		warnx("%s: %u sequences not understood", run.name, vt.unknown);
+		problems++;
+	}
+	bool found = false;
+	for (size_t i = 0; i < baselineLen; ++i) {
+		const struct Baseline *base = &baseline[i];
+		if (strcmp(base->name, run.name)) continue;
+		found = true;
+		if (base->hash != run.hash || base->frames != run.frames) {
+			warnx("%s: screens differ from the baseline", run.name);
+			problems++;
+		}
+		double now = (run.frames ? (double)run.bytes / run.frames : 0);
+		double then = (base->frames ? (double)base->bytes / base->frames : 0);
+		if (now > then) {
+			warnx(
+				"%s: %.1f bytes per frame, up from %.1f",
+				run.name, now, then
+			);
+			problems++;
+		}
+	}
+	if (baseline && !found) {
+		warnx("%s: not in the baseline", run.name);
+		problems++;
+	}
+	return problems;
+}
+
+int main(int argc, char *argv[]) {
+	if (!setlocale(LC_CTYPE, "en_US.UTF-8")) setlocale(LC_CTYPE, "C.UTF-8");
+	const char *base = NULL;
+	for (int opt; 0 < (opt = getopt(argc, argv, "b:sv"));) {
+		switch (opt) {
+			break; case 'b': base = optarg;
+			break; case 's': opts.screens = true;
+			break; case 'v': opts.verbose = true;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (base) baselineRead(base);
+
+	// Board dates are drawn in local time, and FreeCell's curse changes
+	// the flow control of whatever terminal this is run from.
+	setenv("TZ", "UTC", 1);
+	struct termios term;
+	bool tty = !tcgetattr(STDOUT_FILENO, &term);
+	use_env(false);
+	hintsOff = true;
+	gridInit();
+
+	printf(
+		"name\tframes\tbytes\tbytes/frame\tmax bytes"
+		"\tcells\tcells/frame\tscreens\n"
+	);
+	uint problems = 0;
+	for (uint i = 0; i < ARRAY_LEN(Scripts); ++i) {
+		runScript(&Scripts[i]);
+		problems += check();
+	}
+	runBoards();
+	problems += check();
+	for (int i = optind; i < argc; ++i) {
+		runRecording(argv[i]);
+		problems += check();
+	}
+	if (tty) tcsetattr(STDOUT_FILENO, TCSANOW, &term);
+	return (problems ? EX_DATAERR : EX_OK);
+}
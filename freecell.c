@@ -17,38 +17,21 @@
 #include <assert.h>
 #include <ctype.h>
 #include <curses.h>
+#include <err.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysexits.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <utils/arc4random.h>
+#include "play.h"
 
-typedef unsigned uint;
-typedef unsigned char byte;
-
-typedef byte Card;
-enum {
-	A = 1,
-	J = 11,
-	Q = 12,
-	K = 13,
-	Rank = 0x0F,
-	Suit = 0x30,
-	Color = 0x10,
-	Club = 0x00,
-	Diamond = 0x10,
-	Spade = 0x20,
-	Heart = 0x30,
-};
-
-enum { StackCap = 52 };
-struct Stack {
-	byte len;
-	Card cards[StackCap];
-};
 static void push(struct Stack *stack, Card card) {
 	assert(stack->len < StackCap);
 	stack->cards[stack->len++] = card;
@@ -57,80 +40,116 @@ static Card pop(struct Stack *stack) {
 	if (!stack->len) return 0;
 	return stack->cards[--stack->len];
 }
-static Card peek(struct Stack *stack) {
+static Card peek(const struct Stack *stack) {
 	if (!stack->len) return 0;
 	return stack->cards[stack->len-1];
 }
 
-enum {
-	Foundation,
-	Cell = Foundation + 4,
-	Tableau = Cell + 4,
-	Stacks = Tableau + 8,
+// The history packs each move as dst << 4 | src. A move never has dst
+// equal to src, so those bytes mark the start of a group: a user move,
+// with any supermove steps, or a run of automatic foundation moves. Moves
+// from r to w are queued to be shown, and undone groups stay past w until
+// a new move replaces them.
+enum { UserMark = 0x00, AutoMark = 0x11 };
+struct Hist {
+	byte *moves;
+	size_t cap, len;
+	size_t r, w;
+	bool autoRun;
+};
+
+enum { KeysCap = 16 };
+
+// Keys pressed while moves are being shown wait until they're done.
+struct State {
+	uint game;
+	bool replay;
+	bool quit;
+	bool over;
+	uint srcStack;
+	char status[64];
+	struct Stack stacks[Stacks];
+	struct Hist hist;
+	struct Solution solution;
+	uint solutionStep;
+	uint keysLen;
+	int keys[KeysCap];
 };
-static struct Stack stacks[Stacks];
 
-struct Move {
-	byte dst;
-	byte src;
+enum {
+	DirtyTitle = 1 << 0,
+	DirtyStatus = 1 << 1,
 };
+static uint dirtyStack(uint i) {
+	return 1 << (2 + i);
+}
+
+static bool histMark(byte move) {
+	return move >> 4 == (move & 0xF);
+}
+
+static void histPush(struct Hist *hist, byte move) {
+	if (hist->w == hist->cap) {
+		hist->cap = (hist->cap ? hist->cap * 2 : 256);
+		hist->moves = realloc(hist->moves, hist->cap);
+		if (!hist->moves) err(EX_OSERR, "realloc");
+	}
+	hist->moves[hist->w++] = move;
+	hist->len = hist->w;
+}
+
+static void mark(struct State *state, byte mark) {
+	histPush(&state->hist, mark);
+	state->hist.autoRun = (mark == AutoMark);
+}
 
-enum { QCap = 16 };
-static struct {
-	struct Move moves[QCap];
-	uint r, w, u;
-} q;
-static void enq(byte dst, byte src) {
-	q.moves[q.w % QCap].dst = dst;
-	q.moves[q.w % QCap].src = src;
-	q.w++;
-}
-static void deq(void) {
-	struct Move move = q.moves[q.r++ % QCap];
-	push(&stacks[move.dst], pop(&stacks[move.src]));
-}
-static void undo(void) {
-	uint len = q.w - q.u;
-	if (!len || len > QCap) return;
-	for (uint i = len-1; i < len; --i) {
-		struct Move move = q.moves[(q.u+i) % QCap];
-		push(&stacks[move.src], pop(&stacks[move.dst]));
-	}
-	q.r = q.w = q.u;
-}
-
-// https://rosettacode.org/wiki/Deal_cards_for_FreeCell
-static uint lcgState;
-static uint lcg(void) {
-	lcgState = (214013 * lcgState + 2531011) % (1 << 31);
-	return lcgState >> 16;
-}
-static void deal(uint game) {
-	lcgState = game;
-	struct Stack deck = {0};
-	for (Card i = A; i <= K; ++i) {
-		push(&deck, Club | i);
-		push(&deck, Diamond | i);
-		push(&deck, Heart | i);
-		push(&deck, Spade | i);
-	}
-	for (uint stack = 0; deck.len; ++stack) {
-		uint i = lcg() % deck.len;
-		Card card = deck.cards[i];
-		deck.cards[i] = deck.cards[--deck.len];
-		push(&stacks[Tableau + stack%8], card);
-	}
-}
-
-static bool win(void) {
+static void enq(struct State *state, byte dst, byte src) {
+	histPush(&state->hist, dst << 4 | src);
+}
+
+static uint deq(struct State *state) {
+	struct Hist *hist = &state->hist;
+	while (histMark(hist->moves[hist->r])) hist->r++;
+	byte move = hist->moves[hist->r++];
+	struct Stack *stacks = state->stacks;
+	push(&stacks[move >> 4], pop(&stacks[move & 0xF]));
+	return dirtyStack(move >> 4) | dirtyStack(move & 0xF);
+}
+
+static uint undo(struct State *state) {
+	struct Hist *hist = &state->hist;
+	size_t u = hist->w;
+	while (u && hist->moves[--u] != UserMark);
+	if (u == hist->w || hist->moves[u] != UserMark) return 0;
+	uint dirty = 0;
+	for (size_t i = hist->w - 1; i > u; --i) {
+		byte move = hist->moves[i];
+		if (histMark(move)) continue;
+		struct Stack *stacks = state->stacks;
+		push(&stacks[move & 0xF], pop(&stacks[move >> 4]));
+		dirty |= dirtyStack(move >> 4) | dirtyStack(move & 0xF);
+	}
+	hist->r = hist->w = u;
+	hist->autoRun = false;
+	return dirty;
+}
+
+static void redo(struct Hist *hist) {
+	if (hist->w == hist->len) return;
+	size_t end = hist->w + 1;
+	while (end < hist->len && hist->moves[end] != UserMark) end++;
+	hist->w = end;
+}
+
+static bool win(const struct State *state) {
 	for (uint i = Foundation; i < Cell; ++i) {
-		if (stacks[i].len != 13) return false;
+		if (state->stacks[i].len != 13) return false;
 	}
 	return true;
 }
 
-static bool valid(uint dst, Card card) {
-	Card top = peek(&stacks[dst]);
+static bool valid(struct State *state, uint dst, Card card) {
+	Card top = peek(&state->stacks[dst]);
 	if (dst < Cell) {
 		if (!top) return (card & Rank) == A;
 		return (card & Suit) == (top & Suit)
@@ -144,7 +163,8 @@ static bool valid(uint dst, Card card) {
 	return false;
 }
 
-static void autoEnq(void) {
+static void autoEnq(struct State *state) {
+	struct Stack *stacks = state->stacks;
 	Card min[] = { K, K };
 	for (uint i = Cell; i < Stacks; ++i) {
 		for (uint j = 0; j < stacks[i].len; ++j) {
@@ -159,64 +179,98 @@ static void autoEnq(void) {
 		if (!card) continue;
 		if (min[!(card & Color)] < (card & Rank)-1) continue;
 		for (uint dst = Foundation; dst < Cell; ++dst) {
-			if (valid(dst, card)) {
-				enq(dst, src);
+			if (valid(state, dst, card)) {
+				if (!state->hist.autoRun) mark(state, AutoMark);
+				enq(state, dst, src);
 				return;
 			}
 		}
 	}
 }
 
-static void moveSingle(uint dst, uint src) {
-	if (!valid(dst, peek(&stacks[src]))) return;
-	q.u = q.w;
-	enq(dst, src);
+static void moveSingle(struct State *state, uint dst, uint src) {
+	if (!valid(state, dst, peek(&state->stacks[src]))) return;
+	mark(state, UserMark);
+	enq(state, dst, src);
 }
 
-static uint freeCells(uint cells[static 4]) {
+static uint freeCells(const struct State *state, uint cells[static 4]) {
 	uint len = 0;
 	for (uint i = Cell; i < Tableau; ++i) {
-		if (!stacks[i].len) cells[len++] = i;
+		if (!state->stacks[i].len) cells[len++] = i;
 	}
 	return len;
 }
 
-static uint moveDepth(uint src) {
-	struct Stack stack = stacks[src];
-	if (stack.len < 2) return stack.len;
+static uint moveDepth(const struct State *state, uint src) {
+	const struct Stack *stack = &state->stacks[src];
+	if (stack->len < 2) return stack->len;
 	uint n = 1;
-	for (uint i = stack.len-2; i < stack.len; --i, ++n) {
-		if ((stack.cards[i] & Color) == (stack.cards[i+1] & Color)) break;
-		if ((stack.cards[i] & Rank) != (stack.cards[i+1] & Rank) + 1) break;
+	for (uint i = stack->len-2; i < stack->len; --i, ++n) {
+		if ((stack->cards[i] & Color) == (stack->cards[i+1] & Color)) break;
+		if ((stack->cards[i] & Rank) != (stack->cards[i+1] & Rank) + 1) break;
 	}
 	return n;
 }
 
-static void moveColumn(uint dst, uint src) {
-	uint depth;
-	uint cells[4];
-	uint free = freeCells(cells);
-	for (depth = moveDepth(src); depth; --depth) {
-		if (free < depth-1) continue;
-		if (valid(dst, stacks[src].cards[stacks[src].len-depth])) break;
+static uint emptyCols(
+	const struct State *state, uint cols[static 8], uint except
+) {
+	uint len = 0;
+	for (uint i = Tableau; i < Stacks; ++i) {
+		if (!state->stacks[i].len && i != except) cols[len++] = i;
 	}
-	if (depth < 2 || dst < Tableau) {
-		moveSingle(dst, src);
+	return len;
+}
+
+// Moves n cards through the free cells alone if they fit, otherwise parks
+// as few cards as it must in an empty column, moves the rest, and brings
+// the parked cards back on top, each step with one column fewer.
+static void supermoveEnq(
+	struct State *state, uint dst, uint src, uint n,
+	const uint *cells, uint free, const uint *cols, uint empty
+) {
+	if (n <= free + 1) {
+		for (uint i = 0; i < n-1; ++i) {
+			enq(state, cells[i], src);
+		}
+		enq(state, dst, src);
+		for (uint i = n-2; i < n-1; --i) {
+			enq(state, dst, cells[i]);
+		}
 		return;
 	}
-	q.u = q.w;
-	for (uint i = 0; i < depth-1; ++i) {
-		enq(cells[i], src);
+	uint park = cols[empty-1];
+	uint rest = supermove(free, empty-1);
+	if (n <= rest) {
+		supermoveEnq(state, dst, src, n, cells, free, cols, empty-1);
+		return;
 	}
-	enq(dst, src);
-	for (uint i = depth-2; i < depth-1; --i) {
-		enq(dst, cells[i]);
+	uint parked = n - rest;
+	supermoveEnq(state, park, src, parked, cells, free, cols, empty-1);
+	supermoveEnq(state, dst, src, n - parked, cells, free, cols, empty-1);
+	supermoveEnq(state, dst, park, parked, cells, free, cols, empty-1);
+}
+
+static void moveColumn(struct State *state, uint dst, uint src) {
+	const struct Stack *stack = &state->stacks[src];
+	uint depth;
+	uint cells[4], cols[8];
+	uint free = freeCells(state, cells);
+	uint empty = emptyCols(state, cols, dst);
+	for (depth = moveDepth(state, src); depth; --depth) {
+		if (depth > supermove(free, empty)) continue;
+		if (valid(state, dst, stack->cards[stack->len-depth])) break;
 	}
+	if (depth < 2 || dst < Tableau) {
+		moveSingle(state, dst, src);
+		return;
+	}
+	mark(state, UserMark);
+	supermoveEnq(state, dst, src, depth, cells, free, cols, empty);
 }
 
 static void curse(void) {
-	initscr();
-	cbreak();
 	noecho();
 	keypad(stdscr, false);
 	struct termios term;
@@ -224,8 +278,6 @@ static void curse(void) {
 	term.c_iflag &= ~IXON;
 	tcsetattr(STDOUT_FILENO, TCSANOW, &term);
 	curs_set(0);
-	start_color();
-	use_default_colors();
 	init_pair(1, COLOR_BLACK, COLOR_WHITE);
 	init_pair(2, COLOR_RED, COLOR_WHITE);
 	init_pair(3, COLOR_GREEN, -1);
@@ -274,59 +326,153 @@ enum {
 	TableauY = CellY + 2*CardHeight,
 };
 
-static uint game;
-static uint srcStack = Stacks;
+static char stackKey(uint i) {
+	if (i < Cell) return '_';
+	if (i < Tableau) return '1' + i-Cell;
+	return "QWERASDF"[i-Tableau];
+}
 
-static void draw(void) {
-	erase();
-	static char buf[256];
-	if (!buf[0]) snprintf(buf, sizeof(buf), "Game #%u", game);
-	if (win()) {
+static void drawTitle(const struct State *state) {
+	char buf[256];
+	if (state->over) {
 		snprintf(
-			buf, sizeof(buf),
-			"Game #%u win! Press any key to view the scoreboard.",
-			game
+			buf, sizeof(buf), "Game #%u win!%s", state->game,
+			(state->replay ? "" : " Press any key to view the scoreboard.")
 		);
+	} else {
+		snprintf(buf, sizeof(buf), "Game #%u", state->game);
 	}
 	attr_set(A_NORMAL, 3, NULL);
-	mvaddstr(0, Padding, buf);
+	move(0, Padding);
+	clrtoeol();
+	addstr(buf);
+}
+
+// Clears what's under a stack before drawing it, since cards can leave.
+static void drawPile(const struct State *state, uint i) {
+	int y, x;
+	char key = stackKey(i);
+	if (i < Cell) {
+		y = FoundationY;
+		x = FoundationX + (3-(i-Foundation)) * (CardWidth+Padding);
+	} else if (i < Tableau) {
+		y = CellY;
+		x = CellX + (i-Cell) * (CardWidth+Padding);
+	} else {
+		y = TableauY;
+		x = TableauX + (i-Tableau) * (CardWidth+Padding);
+	}
+	attr_set(A_NORMAL, 0, NULL);
+	if (i < Tableau) {
+		mvhline(y, x, ' ', CardWidth);
+		mvaddch(y, x+1, COLOR_PAIR(3) | key);
+	} else {
+		for (int row = y; row < LINES; ++row) {
+			mvhline(row, x, ' ', CardWidth);
+		}
+		mvaddch(y + 8*CardHeight, x+1, COLOR_PAIR(3) | key);
+	}
+	if (i < Cell) {
+		drawCard(false, y, x, peek(&state->stacks[i]));
+	} else {
+		drawStack(i == state->srcStack, y, x, &state->stacks[i]);
+	}
+}
+
+static void render(const void *ptr, uint dirty) {
+	const struct State *state = ptr;
+	if (dirty & DirtyTitle) drawTitle(state);
+	if (dirty & (DirtyTitle | DirtyStatus)) {
+		attr_set(A_NORMAL, 3, NULL);
+		move(1, Padding);
+		clrtoeol();
+		if (!state->over) addstr(state->status);
+	}
 	for (uint i = 0; i < Stacks; ++i) {
-		int y, x;
-		char key;
-		if (i < Cell) {
-			y = FoundationY;
-			x = FoundationX + (3-(i-Foundation)) * (CardWidth+Padding);
-			key = '_';
-		} else if (i < Tableau) {
-			y = CellY;
-			x = CellX + (i-Cell) * (CardWidth+Padding);
-			key = '1' + i-Cell;
-		} else {
-			y = TableauY;
-			x = TableauX + (i-Tableau) * (CardWidth+Padding);
-			key = "QWERASDF"[i-Tableau];
+		if (dirty & dirtyStack(i)) drawPile(state, i);
+	}
+}
+
+enum {
+	SolveBudget = 500,
+	SolveCap = 1 << 17,
+	ShowDelay = 50,
+};
+
+static bool solveHere(struct State *state) {
+	struct Solution *solution = &state->solution;
+	solve(solution, state->stacks, SolveBudget, SolveCap);
+	state->solutionStep = 0;
+	switch (solution->result) {
+		break; case Solved: return true;
+		break; case Unsolvable: {
+			snprintf(
+				state->status, sizeof(state->status),
+				"No way to win from here."
+			);
 		}
-		if (i < Tableau) {
-			mvaddch(y, x+1, COLOR_PAIR(3) | key);
-		} else {
-			mvaddch(y + 8*CardHeight, x+1, COLOR_PAIR(3) | key);
+		break; case GaveUp: {
+			snprintf(
+				state->status, sizeof(state->status),
+				"No solution found in time."
+			);
 		}
-		if (i < Cell) {
-			drawCard(false, y, x, peek(&stacks[i]));
-		} else {
-			drawStack(i == srcStack, y, x, &stacks[i]);
+	}
+	solution->len = 0;
+	return false;
+}
+
+static void hint(struct State *state) {
+	if (!solveHere(state)) return;
+	struct Solution *solution = &state->solution;
+	uint dst = solution->moves[0].dst, src = solution->moves[0].src;
+	bool single = solution->moves[0].len == 1 && moveDepth(state, src) > 1
+		&& dst >= Tableau && !state->stacks[dst].len;
+	snprintf(
+		state->status, sizeof(state->status), "Hint: %c then %s%c",
+		stackKey(src), (single ? "shift-" : ""), stackKey(dst)
+	);
+	solution->len = 0;
+}
+
+// Plays the next move of the solution, stopping if it no longer applies.
+static void finish(struct State *state) {
+	struct Solution *solution = &state->solution;
+	uint dst = solution->moves[state->solutionStep].dst;
+	uint src = solution->moves[state->solutionStep].src;
+	uint len = solution->moves[state->solutionStep].len;
+	state->solutionStep++;
+	if (dst == Foundation) {
+		for (; dst < Cell; ++dst) {
+			if (valid(state, dst, peek(&state->stacks[src]))) break;
 		}
 	}
+	size_t w = state->hist.w;
+	if (dst < Cell || len == 1) {
+		moveSingle(state, dst, src);
+	} else {
+		moveColumn(state, dst, src);
+	}
+	if (state->hist.w == w || state->solutionStep == solution->len) {
+		solution->len = 0;
+	}
 }
 
-static bool quit;
-static void input(void) {
-	char ch = getch();
+static uint input(struct State *state, char ch) {
 	uint stack = Stacks;
+	uint src = state->srcStack;
+	uint dirty = (state->status[0] ? DirtyStatus : 0);
+	state->status[0] = '\0';
 	switch (tolower(ch)) {
-		break; case 'Q'^'@': quit = true;
-		break; case '\33': srcStack = Stacks;
-		break; case 'u': case '\b': case '\177': undo();
+		break; case 'Q'^'@': state->quit = true;
+		break; case '?': hint(state);
+		break; case '\t': solveHere(state);
+		break; case '\33': state->srcStack = Stacks;
+		break; case 'u': {
+			if (isupper(ch)) redo(&state->hist); else dirty |= undo(state);
+		}
+		break; case '\b': case '\177': dirty |= undo(state);
+		break; case 'R'^'@': redo(&state->hist);
 		break; case '1': case '!': stack = Cell+0;
 		break; case '2': case '@': stack = Cell+1;
 		break; case '3': case '#': stack = Cell+2;
@@ -340,51 +486,336 @@ static void input(void) {
 		break; case 's': stack = Tableau+5;
 		break; case 'd': stack = Tableau+6;
 		break; case 'f': stack = Tableau+7;
-		break; case '\n': stack = srcStack;
-		break; case ERR: exit(EXIT_FAILURE);
+		break; case '\n': stack = state->srcStack;
 	}
-	if (stack == Stacks) return;
+	if (state->status[0]) dirty |= DirtyStatus;
+	if (stack == Stacks) goto done;
 
-	if (srcStack < Stacks) {
-		Card card = peek(&stacks[srcStack]);
+	if (state->srcStack < Stacks) {
+		Card card = peek(&state->stacks[state->srcStack]);
 		if (stack == Foundation) {
 			for (; stack < Cell; ++stack) {
-				if (valid(stack, card)) break;
+				if (valid(state, stack, card)) break;
 			}
-			if (stack == Cell) return;
+			if (stack == Cell) goto done;
 		}
-		if (stack == srcStack) {
+		if (stack == state->srcStack) {
 			for (stack = Cell; stack < Stacks; ++stack) {
-				if (!stacks[stack].len) break;
+				if (!state->stacks[stack].len) break;
 			}
-			if (stack == Stacks) return;
+			if (stack == Stacks) goto done;
 		}
 		if (isupper(ch)) {
-			moveSingle(stack, srcStack);
+			moveSingle(state, stack, state->srcStack);
 		} else {
-			moveColumn(stack, srcStack);
+			moveColumn(state, stack, state->srcStack);
+		}
+		state->srcStack = Stacks;
+
+	} else if (stack >= Cell && state->stacks[stack].len) {
+		state->srcStack = stack;
+	}
+done:
+	if (state->srcStack != src) {
+		if (src < Stacks) dirty |= dirtyStack(src);
+		if (state->srcStack < Stacks) dirty |= dirtyStack(state->srcStack);
+	}
+	return dirty;
+}
+
+static bool busy(const struct State *state) {
+	return state->hist.r < state->hist.w || state->solution.len;
+}
+
+// Shows one queued move per tick, then any automatic moves it allows,
+// and only takes keys again once the board has settled.
+static uint step(void *ptr, int key, struct Rng *rng) {
+	(void)rng;
+	struct State *state = ptr;
+	struct Hist *hist = &state->hist;
+	if (state->over) return (key == Tick ? 0 : EventDone);
+	if (key != Tick) {
+		if (busy(state) || state->keysLen) {
+			if (state->keysLen < KeysCap) {
+				state->keys[state->keysLen++] = key;
+			}
+			return 0;
 		}
-		srcStack = Stacks;
+		return input(state, key) | (state->quit ? EventDone : 0);
+	}
+	uint dirty = 0;
+	if (hist->r == hist->w && state->solution.len) finish(state);
+	if (hist->r < hist->w) {
+		dirty |= deq(state);
+		if (hist->r == hist->w && !state->replay) autoEnq(state);
+	} else if (state->keysLen) {
+		dirty |= input(state, state->keys[0]);
+		memmove(
+			&state->keys[0], &state->keys[1],
+			sizeof(state->keys[0]) * --state->keysLen
+		);
+		if (state->quit) return dirty | EventDone;
+	}
+	if (!busy(state) && win(state)) {
+		state->over = true;
+		dirty |= DirtyTitle | EventOver;
+	}
+	return dirty;
+}
+
+static int delay(const void *ptr) {
+	const struct State *state = ptr;
+	if (state->over) return Forever;
+	if (state->hist.r < state->hist.w) return ShowDelay;
+	if (state->solution.len || state->keysLen) return 0;
+	return Forever;
+}
+
+static uint score(const void *ptr) {
+	const struct State *state = ptr;
+	return win(state);
+}
+
+static const struct Deals *deals;
+static int gamesFD = -1;
+
+// Maps the index written by deals, without which any deal may come up,
+// and opens the log that finished games are appended to.
+void prepFreeCell(void) {
+	gamesFD = open("freecell.games", O_WRONLY | O_APPEND | O_CREAT, 0644);
+	int fd = open("freecell.deals", O_RDONLY);
+	if (fd < 0) return;
+	struct stat st;
+	int error = fstat(fd, &st);
+	if (!error && st.st_size == sizeof(*deals)) {
+		void *ptr = mmap(NULL, sizeof(*deals), PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr != MAP_FAILED) deals = ptr;
+	}
+	close(fd);
+	if (deals && memcmp(deals->magic, DealsMagic, sizeof(DealsMagic))) {
+		munmap((void *)deals, sizeof(*deals));
+		deals = NULL;
+	}
+}
+
+static bool dealSolvable(uint i, byte min, byte max) {
+	return deals->solvable[i / 8] >> (i % 8) & 1
+		&& deals->difficulty[i] >= min && deals->difficulty[i] <= max;
+}
+
+static uint dealPick(struct Rng *rng, byte min, byte max) {
+	if (!deals) return 1 + rngUniform(rng, Deals);
+	uint len = 0;
+	for (uint i = 0; i < Deals; ++i) {
+		if (dealSolvable(i, min, max)) len++;
+	}
+	if (!len) return 1 + rngUniform(rng, Deals);
+	uint n = rngUniform(rng, len);
+	for (uint i = 0; i < Deals; ++i) {
+		if (dealSolvable(i, min, max) && !n--) return 1 + i;
+	}
+	return 1;
+}
+
+// The easy and hard games split the solvable deals at their median
+// difficulty, wherever the solver's node counts put it.
+static byte dealMedian(void) {
+	if (!deals) return DealUnknown - 1;
+	uint counts[DealUnknown] = {0}, len = 0;
+	for (uint i = 0; i < Deals; ++i) {
+		if (!dealSolvable(i, 0, DealUnknown - 1)) continue;
+		counts[deals->difficulty[i]]++;
+		len++;
+	}
+	uint median = 0;
+	for (uint n = 0; median < DealUnknown - 1; ++median) {
+		n += counts[median];
+		if (2 * n >= len) break;
+	}
+	return median;
+}
+
+static void
+initRange(struct State *state, struct Rng *rng, byte min, byte max) {
+	state->game = dealPick(rng, min, max);
+	state->srcStack = Stacks;
+	deal(state->stacks, state->game);
+}
+
+static void init(void *ptr, struct Rng *rng) {
+	initRange(ptr, rng, 0, DealUnknown - 1);
+}
+static void initEasy(void *ptr, struct Rng *rng) {
+	initRange(ptr, rng, 0, dealMedian());
+}
+static void initHard(void *ptr, struct Rng *rng) {
+	byte median = dealMedian();
+	if (median == DealUnknown - 1) median--;
+	initRange(ptr, rng, median + 1, DealUnknown - 1);
+}
 
-	} else if (stack >= Cell && stacks[stack].len) {
-		srcStack = stack;
+// Each game is its number and history length as two uint32_t, then the
+// history, in one write so concurrent sessions don't interleave.
+static void histSave(const struct State *state) {
+	const struct Hist *hist = &state->hist;
+	if (gamesFD < 0 || !hist->w) return;
+	size_t len = 2 * sizeof(uint32_t) + hist->w;
+	byte *buf = malloc(len);
+	if (!buf) err(EX_OSERR, "malloc");
+	uint32_t head[2] = { state->game, hist->w };
+	memcpy(buf, head, sizeof(head));
+	memcpy(&buf[sizeof(head)], hist->moves, hist->w);
+	ssize_t n = write(gamesFD, buf, len);
+	if (n < 0) err(EX_IOERR, "freecell.games");
+	free(buf);
+}
+
+// Histories come from files anyone may hand to play -r, so their length
+// is held to far more than any game takes by hand, undos and all.
+enum { HistMax = 64 * SolveLen };
+
+static bool histLoad(struct State *state, FILE *file) {
+	uint32_t head[2];
+	if (!fread(head, sizeof(head), 1, file)) return false;
+	if (head[1] > HistMax) return false;
+	byte *moves = malloc(head[1]);
+	if (!moves) err(EX_OSERR, "malloc");
+	if (!fread(moves, head[1], 1, file)) {
+		free(moves);
+		return false;
 	}
+	free(state->hist.moves);
+	state->game = head[0];
+	state->hist = (struct Hist) {
+		.moves = moves,
+		.cap = head[1],
+		.len = head[1],
+	};
+	return true;
 }
 
-uint playFreeCell(void) {
-	game = 1 + arc4random_uniform(32000);
+static void fini(void *ptr) {
+	struct State *state = ptr;
+	if (!state->replay) histSave(state);
+	free(state->hist.moves);
+}
+
+// Saves the deal and the moves made so far, replaying them to load.
+static size_t save(const void *ptr, byte *buf, size_t cap) {
+	const struct State *state = ptr;
+	uint32_t head[2] = { state->game, state->hist.w };
+	saveCopy(buf, cap, head, sizeof(head));
+	if (cap > sizeof(head)) {
+		saveCopy(
+			&buf[sizeof(head)], cap - sizeof(head),
+			state->hist.moves, state->hist.w
+		);
+	}
+	return sizeof(head) + state->hist.w;
+}
+
+static bool load(void *ptr, const byte *buf, size_t len) {
+	struct State *state = ptr;
+	uint32_t head[2];
+	if (len < sizeof(head)) return false;
+	memcpy(head, buf, sizeof(head));
+	if (!head[0] || head[0] > Deals || len != sizeof(head) + head[1]) {
+		return false;
+	}
+	struct Stack stacks[Stacks];
+	deal(stacks, head[0]);
+	for (uint32_t i = 0; i < head[1]; ++i) {
+		byte move = buf[sizeof(head) + i];
+		if (histMark(move)) continue;
+		if ((move >> 4) >= Stacks || (move & 0xF) >= Stacks) return false;
+		if (!stacks[move & 0xF].len) return false;
+		if (stacks[move >> 4].len == StackCap) return false;
+		push(&stacks[move >> 4], pop(&stacks[move & 0xF]));
+	}
+	struct Hist hist = {0};
+	for (uint32_t i = 0; i < head[1]; ++i) {
+		histPush(&hist, buf[sizeof(head) + i]);
+	}
+	hist.r = hist.w;
+	free(state->hist.moves);
+	*state = (struct State) {
+		.game = head[0],
+		.srcStack = Stacks,
+		.hist = hist,
+	};
+	memcpy(state->stacks, stacks, sizeof(stacks));
+	state->over = win(state);
+	return true;
+}
+
+// Plays back the last game in a file of saved games.
+void replayFreeCell(FILE *file) {
+	struct State *state = calloc(1, sizeof(*state));
+	if (!state) err(EX_OSERR, "calloc");
+	if (!histLoad(state, file)) errx(EX_DATAERR, "no games");
+	while (histLoad(state, file));
+	if (ferror(file)) err(EX_IOERR, "fread");
+	state->replay = true;
+	state->srcStack = Stacks;
+	initscr();
+	cbreak();
+	start_color();
+	use_default_colors();
 	curse();
-	deal(game);
-	while (!quit && !win()) {
-		while (q.r < q.w) {
-			deq();
-			draw();
+	deal(state->stacks, state->game);
+	snprintf(state->status, sizeof(state->status), "Replay");
+	render(state, DirtyAll);
+	while (state->hist.w < state->hist.len) {
+		redo(&state->hist);
+		while (state->hist.r < state->hist.w) {
+			render(state, step(state, Tick, NULL));
 			refresh();
-			usleep(50000);
-			if (q.r == q.w) autoEnq();
+			napms(ShowDelay);
 		}
-		draw();
-		input();
 	}
-	return win();
+	render(state, DirtyAll);
+	mvaddstr(1, Padding, "Press any key to exit.");
+	getch();
+	endwin();
+	fini(state);
+	free(state);
 }
+
+const struct Engine EngineFreeCell = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = init,
+	.fini = fini,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
+
+const struct Engine EngineFreeCellEasy = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = initEasy,
+	.fini = fini,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
+
+const struct Engine EngineFreeCellHard = {
+	.size = sizeof(struct State),
+	.curse = curse,
+	.init = initHard,
+	.fini = fini,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
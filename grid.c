@@ -0,0 +1,134 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "play.h"
+
+enum { Rows = 1 << 16 };
+static uint16_t rowLeft[Rows];
+static uint16_t rowRight[Rows];
+static uint rowScore[Rows];
+
+static uint16_t reverse(uint16_t row) {
+	return (row & 0x000F) << 12 | (row & 0x00F0) << 4
+		| (row & 0x0F00) >> 4 | (row & 0xF000) >> 12;
+}
+
+// Slide, merge, slide, as the original 2048.c did with uint grid[4][4].
+// Tiles stop merging at 2^15, the largest exponent a nibble can hold.
+static uint16_t slide(uint16_t row, uint *score) {
+	uint cells[4];
+	for (uint x = 0; x < 4; ++x) {
+		cells[x] = row >> (4 * x) & 0xF;
+	}
+	uint x = 0;
+	for (uint i = 0; i < 4; ++i) {
+		if (cells[i]) cells[x++] = cells[i];
+	}
+	while (x < 4) cells[x++] = 0;
+	for (x = 0; x < 3; ++x) {
+		if (!cells[x] || cells[x] == 0xF) continue;
+		if (cells[x] != cells[x + 1]) continue;
+		*score += 1 << ++cells[x];
+		for (uint i = x + 1; i < 3; ++i) {
+			cells[i] = cells[i + 1];
+		}
+		cells[3] = 0;
+	}
+	uint16_t result = 0;
+	for (x = 0; x < 4; ++x) {
+		result |= cells[x] << (4 * x);
+	}
+	return result;
+}
+
+void gridInit(void) {
+	if (rowScore[0x0011]) return;
+	for (uint row = 0; row < Rows; ++row) {
+		uint score = 0;
+		rowLeft[row] = slide(row, &score);
+		rowRight[reverse(row)] = reverse(rowLeft[row]);
+		// Runs of equal tiles merge pairwise from either end, so the
+		// score of a row is the same sliding left or right.
+		rowScore[row] = score;
+	}
+}
+
+Grid gridTranspose(Grid grid) {
+	Grid a = (grid & 0xF0F00F0FF0F00F0F)
+		| (grid & 0x0000F0F00000F0F0) << 12
+		| (grid & 0x0F0F00000F0F0000) >> 12;
+	return (a & 0xFF00FF0000FF00FF)
+		| (a & 0x00FF00FF00000000) >> 24
+		| (a & 0x00000000FF00FF00) << 24;
+}
+
+static Grid rows(Grid grid, const uint16_t table[static Rows], uint *score) {
+	Grid result = 0;
+	for (uint y = 0; y < 4; ++y) {
+		uint16_t row = grid >> (16 * y);
+		result |= (Grid)table[row] << (16 * y);
+		if (score) *score += rowScore[row];
+	}
+	return result;
+}
+
+Grid gridMove(Grid grid, enum Dir dir, uint *score) {
+	switch (dir) {
+		break; case Left:  return rows(grid, rowLeft, score);
+		break; case Right: return rows(grid, rowRight, score);
+		break; case Up: {
+			return gridTranspose(rows(gridTranspose(grid), rowLeft, score));
+		}
+		break; case Down: {
+			return gridTranspose(rows(gridTranspose(grid), rowRight, score));
+		}
+		break; default: abort();
+	}
+}
+
+bool gridOver(Grid grid) {
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		if (gridMove(grid, dir, NULL) != grid) return false;
+	}
+	return true;
+}
+
+// Sets the low bit of each empty cell.
+Grid gridEmptyMask(Grid grid) {
+	grid |= grid >> 2;
+	grid |= grid >> 1;
+	return ~grid & 0x1111111111111111;
+}
+
+uint gridEmpty(Grid grid) {
+	return __builtin_popcountll(gridEmptyMask(grid));
+}
+
+// Places a tile of exponent exp in the nth empty cell.
+Grid gridPut(Grid grid, uint n, uint exp) {
+	Grid mask = gridEmptyMask(grid);
+	while (n--) mask &= mask - 1;
+	return grid | (Grid)exp << __builtin_ctzll(mask);
+}
+
+Grid gridSpawn(Grid grid, struct Rng *rng) {
+	uint n = rngUniform(rng, gridEmpty(grid));
+	return gridPut(grid, n, (rngUniform(rng, 10) ? 1 : 2));
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	uint budget = 100;
+	uint moves = -1;
+	for (int opt; 0 < (opt = getopt(argc, argv, "n:t:"));) {
+		switch (opt) {
+			break; case 'n': moves = strtoul(optarg, NULL, 10);
+			break; case 't': budget = strtoul(optarg, NULL, 10);
+			break; default:  return EX_USAGE;
+		}
+	}
+
+	gridInit();
+	Grid grid = gridSpawn(gridSpawn(0, &sessionRng), &sessionRng);
+	uint score = 0;
+	uint move = 0;
+	uint64_t depths = 0, nodes = 0;
+	double start = now();
+	for (; move < moves; ++move) {
+		struct Hint hint = gridHint(grid, budget);
+		if (hint.dir == Dirs) break;
+		depths += hint.depth;
+		nodes += hint.nodes;
+		grid = gridMove(grid, hint.dir, &score);
+		grid = gridSpawn(grid, &sessionRng);
+	}
+	double elapsed = now() - start;
+
+	uint max = 0;
+	for (uint y = 0; y < 4; ++y) {
+		for (uint x = 0; x < 4; ++x) {
+			uint tile = gridTile(grid, y, x);
+			if (tile > max) max = tile;
+		}
+	}
+	printf(
+		"moves %u score %u tile %u depth %.2f nodes %" PRIu64 " nodes/s %.0f\n",
+		move, score, 1 << max, (move ? (double)depths / move : 0),
+		nodes, nodes / elapsed
+	);
+}
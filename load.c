@@ -0,0 +1,399 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// For posix_openpt and friends from glibc.
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Runs sessions of play on ptys, each driven by a bot, in steps of twice
+// as many at once, and reports how every step went until one saturates.
+// Sessions write their scores and metrics where they're run, so it's best
+// run from a scratch copy of play's directory.
+
+// Snake only draws on ticks, so its keys aren't timed.
+static const struct Bot {
+	const char *game;
+	const char *keys;
+	uint think;
+	const char *quit;
+	bool timed;
+} Bots[] = {
+	{ "snake", "hjkl", 1000, "qx", false },
+	{ "2048", "hjkl", 300, "q", true },
+	{ "freecell", "qwerasdf1234 ", 500, "\21", true },
+};
+
+struct Session {
+	pid_t pid;
+	int fd;
+	const struct Bot *bot;
+	uint64_t next;
+	uint64_t quit;
+	uint64_t sent;
+	uint64_t sync;
+	uint64_t interval;
+	bool scores;
+	char tail[16];
+};
+
+enum {
+	SessionsCap = 4096,
+	DrainUsec = 10 * 1000000,
+	ScoresUsec = 250 * 1000,
+};
+
+static struct Session sessions[SessionsCap];
+static struct pollfd fds[SessionsCap];
+static uint len;
+
+static const char *cmd = "./play";
+static const struct Bot *bots[ARRAY_LEN(Bots)];
+static uint botsLen;
+static uint spawned;
+static struct Rng rng;
+
+static uint64_t usec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Somewhere from half to one and a half times ms from now.
+static uint64_t after(uint64_t now, uint ms) {
+	return now + 500 * (uint64_t)ms + 1000 * (uint64_t)rngUniform(&rng, ms);
+}
+
+static void spawn(uint64_t now, uint life) {
+	if (len == SessionsCap) errx(EX_SOFTWARE, "too many sessions");
+	const struct Bot *bot = bots[spawned++ % botsLen];
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0) err(EX_OSERR, "posix_openpt");
+	if (grantpt(fd) || unlockpt(fd)) err(EX_OSERR, "grantpt");
+	const char *name = ptsname(fd);
+	if (!name) err(EX_OSERR, "ptsname");
+	struct winsize size = { .ws_row = 24, .ws_col = 80 };
+	if (ioctl(fd, TIOCSWINSZ, &size)) err(EX_OSERR, "TIOCSWINSZ");
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	// The child holds a pipe open until exec, by when it has the tty open
+	// and the master won't see a hangup.
+	int ready[2];
+	if (pipe(ready)) err(EX_OSERR, "pipe");
+	fcntl(ready[1], F_SETFD, FD_CLOEXEC);
+
+	pid_t pid = fork();
+	if (pid < 0) err(EX_OSERR, "fork");
+	if (!pid) {
+		close(ready[0]);
+		setsid();
+		int tty = open(name, O_RDWR);
+		if (tty < 0) _exit(EX_OSERR);
+		ioctl(tty, TIOCSCTTY, 0);
+		// Leave ^Q for FreeCell rather than flow control.
+		struct termios term;
+		if (!tcgetattr(tty, &term)) {
+			term.c_iflag &= ~IXON;
+			tcsetattr(tty, TCSANOW, &term);
+		}
+		dup2(tty, STDIN_FILENO);
+		dup2(tty, STDOUT_FILENO);
+		dup2(tty, STDERR_FILENO);
+		if (tty > STDERR_FILENO) close(tty);
+		setenv("SSH_ORIGINAL_COMMAND", bot->game, 1);
+		setenv("TERM", "xterm", 0);
+		execl(cmd, "play", NULL);
+		int error = errno;
+		ssize_t n = write(ready[1], &error, sizeof(error));
+		(void)n;
+		_exit(EX_UNAVAILABLE);
+	}
+	close(ready[1]);
+	int error;
+	ssize_t n = read(ready[0], &error, sizeof(error));
+	close(ready[0]);
+	if (n == sizeof(error)) {
+		errno = error;
+		err(EX_UNAVAILABLE, "%s", cmd);
+	}
+	sessions[len] = (struct Session) {
+		.pid = pid,
+		.fd = fd,
+		.bot = bot,
+		.next = after(now, bot->think),
+		.quit = after(now, 1000 * life),
+	};
+	fds[len] = (struct pollfd) { .fd = fd, .events = POLLIN };
+	len++;
+}
+
+static struct Step {
+	uint sessions;
+	uint games;
+	uint hangups;
+	struct MetricsHist key;
+	struct MetricsHist jitter;
+	struct MetricsHist lock;
+	struct MetricsHist late;
+	double cpu;
+	long maxrss;
+} step;
+
+static void reap(uint i) {
+	close(sessions[i].fd);
+	int status;
+	if (waitpid(sessions[i].pid, &status, 0) < 0) err(EX_OSERR, "waitpid");
+	if (WIFEXITED(status) && WEXITSTATUS(status) == EX_OK) {
+		step.games++;
+	} else {
+		step.hangups++;
+	}
+	sessions[i] = sessions[--len];
+	fds[i] = fds[len];
+}
+
+static void type(struct Session *session, const char *keys) {
+	ssize_t n = write(session->fd, keys, strlen(keys));
+	(void)n;
+}
+
+// Takes one key per think, until the scoreboards come up, and then keys
+// to get through them and its name prompt.
+static void act(struct Session *session, uint64_t now) {
+	const struct Bot *bot = session->bot;
+	if (session->scores) {
+		type(session, "x");
+		session->next = now + ScoresUsec;
+	} else if (session->quit && now >= session->quit) {
+		type(session, bot->quit);
+		session->quit = 0;
+		session->next = now + ScoresUsec;
+	} else {
+		char key[2] = { bot->keys[rngUniform(&rng, strlen(bot->keys))] };
+		type(session, key);
+		if (bot->timed) session->sent = now;
+		session->next = after(now, bot->think);
+	}
+}
+
+// Times the first output after each key, answers status reports, and
+// watches for the scoreboard. Jitter is how much each interval between
+// status reports, sent once a tick, differs from the one before.
+static void output(struct Session *session, uint64_t now) {
+	char buf[sizeof(session->tail) + 4096];
+	size_t tail = strlen(session->tail);
+	memcpy(buf, session->tail, tail);
+	ssize_t n = read(session->fd, &buf[tail], sizeof(buf) - tail - 1);
+	if (n <= 0) return;
+	buf[tail + n] = '\0';
+	if (session->sent) {
+		metricsObserve(&step.key, now - session->sent);
+		session->sent = 0;
+	}
+	for (char *ptr = buf; (ptr = strstr(ptr, "\33[5n")); ptr += 4) {
+		if (ptr + 4 <= &buf[tail]) continue;
+		type(session, "\33[0n");
+		if (session->sync) {
+			uint64_t interval = now - session->sync;
+			if (session->interval) {
+				metricsObserve(
+					&step.jitter,
+					(interval > session->interval
+						? interval - session->interval
+						: session->interval - interval)
+				);
+			}
+			session->interval = interval;
+		}
+		session->sync = now;
+	}
+	if (!session->scores && strstr(buf, "WEEKLY SCORES")) {
+		session->scores = true;
+		session->next = now + ScoresUsec;
+		type(session, "bot\n");
+	}
+	size_t keep = (tail + n < sizeof(session->tail) - 1)
+		? tail + n : sizeof(session->tail) - 1;
+	memcpy(session->tail, &buf[tail + n - keep], keep);
+	session->tail[keep] = '\0';
+}
+
+static void diff(struct MetricsHist *a, const struct MetricsHist *b) {
+	a->count -= b->count;
+	for (uint i = 0; i < MetricsBuckets; ++i) {
+		a->buckets[i] -= b->buckets[i];
+	}
+}
+
+static double seconds(struct timeval tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Keeps n sessions going for secs seconds, then lets them finish.
+static void run(uint n, uint secs, uint life) {
+	step = (struct Step) { .sessions = n };
+	struct MetricsHist lock = {0}, late = {0};
+	metricsSample("play.metrics", &lock, &late);
+	struct rusage before;
+	getrusage(RUSAGE_CHILDREN, &before);
+
+	uint64_t start = usec();
+	uint64_t end = start + 1000000ULL * secs;
+	bool draining = false;
+	for (;;) {
+		uint64_t now = usec();
+		if (!draining && now >= end) {
+			draining = true;
+			for (uint i = 0; i < len; ++i) {
+				if (!sessions[i].scores) sessions[i].quit = now;
+			}
+		}
+		if (draining && !len) break;
+		if (draining && now >= end + DrainUsec) {
+			while (len) {
+				kill(sessions[0].pid, SIGHUP);
+				reap(0);
+			}
+			break;
+		}
+		while (!draining && len < n) spawn(now, life);
+
+		uint64_t next = (draining ? end + DrainUsec : end);
+		for (uint i = 0; i < len; ++i) {
+			if (sessions[i].next <= now) act(&sessions[i], now);
+			if (sessions[i].next < next) next = sessions[i].next;
+		}
+		int wait = (next > now ? (next - now + 999) / 1000 : 0);
+		int ready = poll(fds, len, wait);
+		if (ready < 0 && errno != EINTR) err(EX_OSERR, "poll");
+		now = usec();
+		for (uint i = len; i-- > 0;) {
+			if (fds[i].revents & POLLIN) output(&sessions[i], now);
+			if (fds[i].revents & (POLLHUP | POLLERR)) reap(i);
+		}
+	}
+
+	uint64_t elapsed = usec() - start;
+	struct rusage after;
+	getrusage(RUSAGE_CHILDREN, &after);
+	step.cpu = seconds(after.ru_utime) - seconds(before.ru_utime)
+		+ seconds(after.ru_stime) - seconds(before.ru_stime);
+	step.cpu /= elapsed / 1e6;
+	step.maxrss = after.ru_maxrss;
+	if (metricsSample("play.metrics", &step.lock, &step.late)) {
+		diff(&step.lock, &lock);
+		diff(&step.late, &late);
+	}
+}
+
+static void header(void) {
+	printf(
+		"%8s %6s %7s %9s %9s %9s %9s %9s %7s %9s %6s %8s\n",
+		"sessions", "games", "hangups", "key p50", "key p99",
+		"jitter50", "jitter99", "late p99", "locks", "lock p99",
+		"cpu%", "maxrss"
+	);
+}
+
+static void report(void) {
+	printf(
+		"%8u %6u %7u %9ju %9ju %9ju %9ju %9ju %7ju %9ju %6.1f %8ld\n",
+		step.sessions, step.games, step.hangups,
+		(uintmax_t)metricsQuantile(&step.key, 0.5),
+		(uintmax_t)metricsQuantile(&step.key, 0.99),
+		(uintmax_t)metricsQuantile(&step.jitter, 0.5),
+		(uintmax_t)metricsQuantile(&step.jitter, 0.99),
+		(uintmax_t)metricsQuantile(&step.late, 0.99),
+		(uintmax_t)step.lock.count,
+		(uintmax_t)metricsQuantile(&step.lock, 0.99),
+		100 * step.cpu, step.maxrss
+	);
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+	uint min = 8, max = 512;
+	uint secs = 10, life = 30;
+	uint keyLimit = 100, jitterLimit = 15;
+	char *games = NULL;
+	for (int opt; 0 < (opt = getopt(argc, argv, "J:K:N:c:g:l:n:t:"));) {
+		switch (opt) {
+			break; case 'J': jitterLimit = strtoul(optarg, NULL, 10);
+			break; case 'K': keyLimit = strtoul(optarg, NULL, 10);
+			break; case 'N': max = strtoul(optarg, NULL, 10);
+			break; case 'c': cmd = optarg;
+			break; case 'g': games = optarg;
+			break; case 'l': life = strtoul(optarg, NULL, 10);
+			break; case 'n': min = strtoul(optarg, NULL, 10);
+			break; case 't': secs = strtoul(optarg, NULL, 10);
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (!min || max > SessionsCap) errx(EX_USAGE, "bad session counts");
+	if (!life) errx(EX_USAGE, "bad game life");
+
+	for (char *game; games && (game = strsep(&games, ","));) {
+		uint i;
+		for (i = 0; i < ARRAY_LEN(Bots); ++i) {
+			if (!strcmp(Bots[i].game, game)) break;
+		}
+		if (i == ARRAY_LEN(Bots)) errx(EX_USAGE, "no bot for %s", game);
+		if (botsLen < ARRAY_LEN(bots)) bots[botsLen++] = &Bots[i];
+	}
+	if (!botsLen) {
+		for (uint i = 0; i < ARRAY_LEN(Bots); ++i) {
+			bots[botsLen++] = &Bots[i];
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	// Quantiles are the upper bounds of power of two buckets, so a step
+	// only saturates once the bucket holding p99 starts past a limit.
+	header();
+	for (uint n = min; n <= max; n *= 2) {
+		run(n, secs, life);
+		report();
+		uint64_t key = metricsQuantile(&step.key, 0.99) / 2;
+		uint64_t jitter = metricsQuantile(&step.jitter, 0.99) / 2;
+		uint64_t late = metricsQuantile(&step.late, 0.99) / 2;
+		if (
+			key >= 1000 * keyLimit ||
+			jitter >= 1000 * jitterLimit || late >= 1000 * jitterLimit
+		) {
+			printf("saturated at %u sessions\n", n);
+			return EX_OK;
+		}
+	}
+	printf("not saturated at %u sessions\n", max);
+}
@@ -0,0 +1,359 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Every session maps the same file and only ever adds to its counters with
+// relaxed atomics, so neither sessions nor readers take any lock once it
+// is set up. Histogram bucket i counts values up to 2^i.
+
+enum { Buckets = MetricsBuckets };
+
+struct Histogram {
+	atomic_uint_least64_t count;
+	atomic_uint_least64_t sum;
+	atomic_uint_least64_t buckets[Buckets];
+};
+
+static const char Magic[8] = "metric\0\1";
+
+static struct Metrics {
+	char magic[8];
+	struct {
+		atomic_uint_least64_t sessions;
+		atomic_uint_least64_t started;
+		atomic_uint_least64_t finished;
+		struct Histogram seconds;
+	} games[MetricsGames];
+	atomic_uint_least64_t frames;
+	atomic_uint_least64_t lines;
+	struct Histogram frameLines;
+	struct Histogram lockUsec;
+	struct Histogram lateUsec;
+} *metrics;
+
+static void add(atomic_uint_least64_t *counter, uint64_t n) {
+	atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static uint64_t get(const atomic_uint_least64_t *counter) {
+	return atomic_load_explicit(
+		(atomic_uint_least64_t *)counter, memory_order_relaxed
+	);
+}
+
+static uint bucket(uint64_t value) {
+	uint i = (value > 1 ? 64 - __builtin_clzll(value - 1) : 0);
+	return (i < Buckets ? i : Buckets - 1);
+}
+
+static void observe(struct Histogram *hist, uint64_t value) {
+	add(&hist->count, 1);
+	add(&hist->sum, value);
+	add(&hist->buckets[bucket(value)], 1);
+}
+
+static uint64_t usec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static struct Metrics *metricsMap(const char *path, bool write) {
+	int fd = open(path, (write ? O_RDWR | O_CREAT : O_RDONLY), 0644);
+	if (fd < 0) return NULL;
+	struct Metrics *map = NULL;
+	if (write) {
+		int error = flock(fd, LOCK_EX);
+		struct stat st;
+		if (!error) error = fstat(fd, &st);
+		if (!error && st.st_size != sizeof(*map)) {
+			error = ftruncate(fd, 0) || ftruncate(fd, sizeof(*map));
+		}
+		if (!error) {
+			map = mmap(
+				NULL, sizeof(*map), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+			);
+		}
+		if (map == MAP_FAILED) map = NULL;
+		if (map && memcmp(map->magic, Magic, sizeof(Magic))) {
+			memset(map, 0, sizeof(*map));
+			memcpy(map->magic, Magic, sizeof(Magic));
+		}
+		flock(fd, LOCK_UN);
+	} else {
+		struct stat st;
+		int error = fstat(fd, &st);
+		if (!error && st.st_size == sizeof(*map)) {
+			map = mmap(NULL, sizeof(*map), PROT_READ, MAP_SHARED, fd, 0);
+		}
+		if (map == MAP_FAILED) map = NULL;
+		if (map && memcmp(map->magic, Magic, sizeof(Magic))) {
+			munmap(map, sizeof(*map));
+			map = NULL;
+		}
+	}
+	close(fd);
+	return map;
+}
+
+static uint game = MetricsGames;
+static uint64_t gameStart;
+
+// Safe to call from a signal handler, for sessions ended by a signal
+// without running atexit handlers.
+void metricsAbort(void) {
+	if (game < MetricsGames) add(&metrics->games[game].sessions, -1);
+	game = MetricsGames;
+}
+
+// Sessions run without metrics if the file can't be opened.
+void metricsOpen(const char *path) {
+	metrics = metricsMap(path, true);
+	if (!metrics) return;
+	atexit(metricsAbort);
+}
+
+void metricsGameStart(uint index) {
+	if (!metrics || index >= MetricsGames) return;
+	game = index;
+	gameStart = usec();
+	add(&metrics->games[game].sessions, 1);
+	add(&metrics->games[game].started, 1);
+}
+
+void metricsGameEnd(void) {
+	if (!metrics || game == MetricsGames) return;
+	add(&metrics->games[game].finished, 1);
+	observe(&metrics->games[game].seconds, (usec() - gameStart) / 1000000);
+	metricsAbort();
+}
+
+uint64_t metricsClock(void) {
+	return (metrics ? usec() : 0);
+}
+
+void metricsLockWait(uint64_t start) {
+	if (!metrics) return;
+	observe(&metrics->lockUsec, usec() - start);
+}
+
+void metricsFrame(uint lines) {
+	if (!metrics) return;
+	add(&metrics->frames, 1);
+	add(&metrics->lines, lines);
+	observe(&metrics->frameLines, lines);
+}
+
+void metricsTickLate(uint64_t late) {
+	if (!metrics) return;
+	observe(&metrics->lateUsec, late);
+}
+
+static void sample(struct MetricsHist *copy, const struct Histogram *hist) {
+	copy->count = get(&hist->count);
+	for (uint i = 0; i < Buckets; ++i) {
+		copy->buckets[i] = get(&hist->buckets[i]);
+	}
+}
+
+// Upper bound of the bucket holding the given quantile.
+uint64_t metricsQuantile(const struct MetricsHist *hist, double q) {
+	if (!hist->count) return 0;
+	uint64_t rank = q * (hist->count - 1), seen = 0;
+	for (uint i = 0; i < Buckets; ++i) {
+		seen += hist->buckets[i];
+		if (seen > rank) return 1ULL << i;
+	}
+	return 1ULL << (Buckets - 1);
+}
+
+static uint64_t quantile(const struct Histogram *hist, double q) {
+	struct MetricsHist copy;
+	sample(&copy, hist);
+	return metricsQuantile(&copy, q);
+}
+
+void metricsObserve(struct MetricsHist *hist, uint64_t value) {
+	hist->count++;
+	hist->buckets[bucket(value)]++;
+}
+
+// Copies the lock wait and tick lateness histograms out of the file.
+bool metricsSample(
+	const char *path, struct MetricsHist *lock, struct MetricsHist *late
+) {
+	struct Metrics *map = metricsMap(path, false);
+	if (!map) return false;
+	sample(lock, &map->lockUsec);
+	sample(late, &map->lateUsec);
+	munmap(map, sizeof(*map));
+	return true;
+}
+
+static void printHistogram(
+	FILE *file, const char *name, const char *labels,
+	const struct Histogram *hist
+) {
+	uint64_t seen = 0;
+	for (uint i = 0; i < Buckets; ++i) {
+		seen += get(&hist->buckets[i]);
+		fprintf(
+			file, "%s_bucket{%s%sle=\"%" PRIu64 "\"} %" PRIu64 "\n",
+			name, labels, (labels[0] ? "," : ""), (uint64_t)1 << i, seen
+		);
+	}
+	fprintf(
+		file, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+		name, labels, (labels[0] ? "," : ""), get(&hist->count)
+	);
+	const char *open = (labels[0] ? "{" : ""), *close = (labels[0] ? "}" : "");
+	fprintf(
+		file, "%s_sum%s%s%s %" PRIu64 "\n",
+		name, open, labels, close, get(&hist->sum)
+	);
+	fprintf(
+		file, "%s_count%s%s%s %" PRIu64 "\n",
+		name, open, labels, close, get(&hist->count)
+	);
+}
+
+// Writes the Prometheus text exposition format.
+static void metricsPrint(
+	FILE *file, const struct Metrics *map, const char *const names[], uint len
+) {
+	for (uint i = 0; i < len && i < MetricsGames; ++i) {
+		char labels[64];
+		snprintf(labels, sizeof(labels), "game=\"%s\"", names[i]);
+		fprintf(
+			file, "play_sessions{%s} %" PRIu64 "\n",
+			labels, get(&map->games[i].sessions)
+		);
+		fprintf(
+			file, "play_games_started_total{%s} %" PRIu64 "\n",
+			labels, get(&map->games[i].started)
+		);
+		fprintf(
+			file, "play_games_finished_total{%s} %" PRIu64 "\n",
+			labels, get(&map->games[i].finished)
+		);
+		printHistogram(
+			file, "play_game_seconds", labels, &map->games[i].seconds
+		);
+	}
+	fprintf(file, "play_frames_total %" PRIu64 "\n", get(&map->frames));
+	fprintf(file, "play_frame_lines_total %" PRIu64 "\n", get(&map->lines));
+	printHistogram(file, "play_frame_lines", "", &map->frameLines);
+	printHistogram(file, "play_scores_lock_usec", "", &map->lockUsec);
+	printHistogram(file, "play_tick_late_usec", "", &map->lateUsec);
+}
+
+static void row(int y, const char *name, const struct Histogram *hist) {
+	mvprintw(
+		y, 0, "%-16s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64,
+		name, get(&hist->count),
+		quantile(hist, 0.5), quantile(hist, 0.99), quantile(hist, 1)
+	);
+	clrtoeol();
+}
+
+static void draw(
+	const struct Metrics *map, const char *const names[], uint len,
+	double frames, double lines
+) {
+	attr_set(A_BOLD, 0, NULL);
+	mvprintw(
+		0, 0, "%-16s %10s %10s %10s %10s",
+		"game", "sessions", "started", "finished", "p50 s"
+	);
+	attr_set(A_NORMAL, 0, NULL);
+	int y = 1;
+	for (uint i = 0; i < len && i < MetricsGames; ++i, ++y) {
+		mvprintw(
+			y, 0, "%-16s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64,
+			names[i], get(&map->games[i].sessions),
+			get(&map->games[i].started), get(&map->games[i].finished),
+			quantile(&map->games[i].seconds, 0.5)
+		);
+		clrtoeol();
+	}
+	y++;
+	attr_set(A_BOLD, 0, NULL);
+	mvprintw(
+		y++, 0, "%-16s %10s %10s %10s %10s",
+		"histogram", "count", "p50", "p99", "max"
+	);
+	attr_set(A_NORMAL, 0, NULL);
+	row(y++, "frame lines", &map->frameLines);
+	row(y++, "lock usec", &map->lockUsec);
+	row(y++, "tick late usec", &map->lateUsec);
+	y++;
+	mvprintw(y++, 0, "%.1f frames/s, %.1f lines/s", frames, lines);
+	clrtoeol();
+	mvaddstr(y + 1, 0, "Press q to quit.");
+}
+
+// Shows the metrics once a second until q, or prints them once as text.
+int metricsShow(
+	const char *path, const char *const names[], uint len, bool text
+) {
+	const struct Metrics *map = metricsMap(path, false);
+	if (!map) errx(EX_NOINPUT, "%s: no metrics", path);
+	if (text) {
+		metricsPrint(stdout, map, names, len);
+		return (ferror(stdout) ? EX_IOERR : EX_OK);
+	}
+	initscr();
+	cbreak();
+	noecho();
+	curs_set(0);
+	timeout(1000);
+	uint64_t frames = get(&map->frames), lines = get(&map->lines);
+	uint64_t then = usec();
+	double frameRate = 0, lineRate = 0;
+	for (;;) {
+		draw(map, names, len, frameRate, lineRate);
+		refresh();
+		int ch = getch();
+		if (ch == 'q') break;
+		uint64_t now = usec();
+		if (now - then < 1000000) continue;
+		double elapsed = (now - then) / 1e6;
+		frameRate = (get(&map->frames) - frames) / elapsed;
+		lineRate = (get(&map->lines) - lines) / elapsed;
+		frames = get(&map->frames);
+		lines = get(&map->lines);
+		then = now;
+	}
+	endwin();
+	return EX_OK;
+}
@@ -0,0 +1,495 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils/arc4random.h>
+
+#include "play.h"
+
+static volatile uint sink;
+
+static void benchArc4random(uint64_t n) {
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = arc4random_uniform(16);
+	}
+}
+
+static void benchRngEntropy(uint64_t n) {
+	struct Rng rng = {0};
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = rngUniform(&rng, 16);
+	}
+}
+
+static void benchRngSeeded(uint64_t n) {
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = rngUniform(&rng, 16);
+	}
+}
+
+// A full board of distinct names with scores falling down the ranks.
+static void scoresFill(void) {
+	for (uint i = 0; i < ScoresLen; ++i) {
+		scores[i].date = 1600000000 + 86400 * (i % 365);
+		scores[i].score = 10 * (ScoresLen - i);
+		snprintf(scores[i].name, sizeof(scores[i].name), "player%u", i);
+	}
+}
+
+static void benchScoresInsert(uint64_t n) {
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	scoresFill();
+	struct Score new = { .date = 1600000000, .name = "new" };
+	for (uint64_t i = 0; i < n; ++i) {
+		new.score = 1 + rngUniform(&rng, 10 * ScoresLen);
+		sink = scoresInsert(new);
+	}
+}
+
+static void benchScoresAccum(uint64_t n) {
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	scoresFill();
+	struct Score acc = { .date = 1600000000, .score = 1 };
+	for (uint64_t i = 0; i < n; ++i) {
+		uint j = rngUniform(&rng, ScoresLen);
+		snprintf(acc.name, sizeof(acc.name), "player%u", j);
+		sink = scoresAccum(acc);
+	}
+}
+
+static void benchBoardScore(uint64_t n) {
+	scoresFill();
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = boardScore(i % ScoresLen)[0];
+	}
+}
+
+// Boards from one seeded random game, so every run moves the same tiles.
+enum { GridsLen = 256 };
+static Grid grids[GridsLen];
+
+static void gridsFill(void) {
+	if (grids[0]) return;
+	gridInit();
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	Grid grid = gridSpawn(gridSpawn(0, &rng), &rng);
+	uint score = 0;
+	for (uint i = 0; i < GridsLen; ++i) {
+		grids[i] = grid;
+		Grid next = gridMove(grid, rngUniform(&rng, Dirs), &score);
+		if (gridOver(next)) next = 0;
+		grid = gridSpawn(next, &rng);
+	}
+}
+
+static void benchGridMove(uint64_t n, enum Dir dir) {
+	gridsFill();
+	uint score = 0;
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = gridMove(grids[i % GridsLen], dir, &score);
+	}
+}
+static void benchGridLeft(uint64_t n) { benchGridMove(n, Left); }
+static void benchGridRight(uint64_t n) { benchGridMove(n, Right); }
+static void benchGridUp(uint64_t n) { benchGridMove(n, Up); }
+static void benchGridDown(uint64_t n) { benchGridMove(n, Down); }
+
+static void benchGridOver(uint64_t n) {
+	gridsFill();
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = gridOver(grids[i % GridsLen]);
+	}
+}
+
+// Every size slides its boards each way in turn, so one op is one move of
+// any direction and sizes compare as moves per second.
+static void benchGridSized(uint64_t n) {
+	gridsFill();
+	uint score = 0;
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = gridMove(grids[i % GridsLen], i % Dirs, &score);
+	}
+}
+
+static struct Tiles tiles[TilesMax + 1][GridsLen];
+
+static void tilesFill(uint size) {
+	if (tiles[size][0].n) return;
+	tilesInit();
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	struct Tiles empty = { .n = size };
+	struct Tiles board = tilesSpawn(tilesSpawn(empty, &rng), &rng);
+	uint score = 0;
+	for (uint i = 0; i < GridsLen; ++i) {
+		tiles[size][i] = board;
+		struct Tiles next = tilesMove(board, rngUniform(&rng, Dirs), &score);
+		if (tilesOver(next)) next = empty;
+		board = (tilesEmpty(next) ? tilesSpawn(next, &rng) : next);
+	}
+}
+
+static void benchTilesMove(uint64_t n, uint size) {
+	tilesFill(size);
+	uint score = 0;
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = tilesMove(tiles[size][i % GridsLen], i % Dirs, &score).rows[0];
+	}
+}
+static void benchTiles3(uint64_t n) { benchTilesMove(n, 3); }
+static void benchTiles5(uint64_t n) { benchTilesMove(n, 5); }
+static void benchTiles6(uint64_t n) { benchTilesMove(n, 6); }
+static void benchTiles8(uint64_t n) { benchTilesMove(n, 8); }
+
+// The worm follows a cycle through every cell: right along even rows,
+// left along odd rows back to column 1, then up column 0 from the bottom
+// row. Any food in its way is taken off first so its length stays put.
+static void cycleTurn(struct Worm *worm) {
+	int y = worm->head.y, x = worm->head.x;
+	if (x == 0) {
+		if (y) {
+			wormTurn(worm, -1, 0);
+		} else {
+			wormTurn(worm, 0, +1);
+		}
+	} else if (y % 2 == 0) {
+		if (x + 1 == WormCols) {
+			wormTurn(worm, +1, 0);
+		} else {
+			wormTurn(worm, 0, +1);
+		}
+	} else if (x == 1 && y + 1 < WormRows) {
+		wormTurn(worm, +1, 0);
+	} else {
+		wormTurn(worm, 0, -1);
+	}
+}
+
+static void cycleClear(struct Worm *worm) {
+	int y = worm->head.y + worm->head.dy;
+	int x = worm->head.x + worm->head.dx;
+	if (!(worm->food.bits[y] >> x & 1)) return;
+	for (uint i = 0; i < worm->food.len; ++i) {
+		if (worm->food.y[i] != y || worm->food.x[i] != x) continue;
+		worm->food.bits[y] &= ~(1ULL << x);
+		worm->food.len--;
+		worm->food.y[i] = worm->food.y[worm->food.len];
+		worm->food.x[i] = worm->food.x[worm->food.len];
+		worm->food.age[i] = worm->food.age[worm->food.len];
+		return;
+	}
+}
+
+static void benchWorm(uint64_t n, uint len) {
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	static struct Worm worm;
+	wormInit(&worm);
+	worm.head.y = 0;
+	worm.head.x = 0;
+	worm.body.len = 0;
+	memset(worm.body.bits, 0, sizeof(worm.body.bits));
+	// Grow along the cycle by moving the head and leaving a segment behind.
+	for (uint i = 0; i < len; ++i) {
+		cycleTurn(&worm);
+		uint first = (worm.body.first ? worm.body.first : WormCap) - 1;
+		worm.body.first = first;
+		worm.body.y[first] = worm.head.y;
+		worm.body.x[first] = worm.head.x;
+		worm.body.bits[worm.head.y] |= 1ULL << worm.head.x;
+		worm.body.len++;
+		worm.head.y += worm.head.dy;
+		worm.head.x += worm.head.dx;
+	}
+	for (uint64_t i = 0; i < n; ++i) {
+		cycleTurn(&worm);
+		cycleClear(&worm);
+		wormTick(&worm, &rng);
+	}
+	if (worm.over) errx(EX_SOFTWARE, "worm: %s", worm.over);
+	sink = worm.body.len;
+}
+static void benchWorm4(uint64_t n) { benchWorm(n, 4); }
+static void benchWorm64(uint64_t n) { benchWorm(n, 64); }
+static void benchWorm512(uint64_t n) { benchWorm(n, 512); }
+static void benchWorm1024(uint64_t n) { benchWorm(n, 1024); }
+
+static void benchDeal(uint64_t n) {
+	struct Stack stacks[Stacks];
+	for (uint64_t i = 0; i < n; ++i) {
+		deal(stacks, 1 + i % Deals);
+		sink = stacks[Tableau].cards[0];
+	}
+}
+
+// FreeCell's rules are private to its engine, so valid, moveColumn and
+// autoEnq are timed by playing a solved deal through it with keys and
+// ticks, and the history replay by loading the finished game.
+enum { FreeCellGame = 1 };
+static struct {
+	size_t keysLen;
+	int keys[4 * SolveLen];
+	size_t saveLen;
+	byte save[4096];
+} freeCell;
+
+static void freeCellKeys(const struct Solution *solution) {
+	static const char Cells[] = "1234", Cols[] = "qwerasdf";
+	freeCell.keysLen = 0;
+	for (uint i = 0; i < solution->len; ++i) {
+		uint dst = solution->moves[i].dst, src = solution->moves[i].src;
+		int key = (src < Tableau ? Cells[src - Cell] : Cols[src - Tableau]);
+		freeCell.keys[freeCell.keysLen++] = key;
+		if (dst < Cell) {
+			key = ' ';
+		} else if (dst < Tableau) {
+			key = Cells[dst - Cell];
+		} else {
+			key = Cols[dst - Tableau];
+			if (solution->moves[i].len == 1) key -= 'a' - 'A';
+		}
+		freeCell.keys[freeCell.keysLen++] = key;
+	}
+}
+
+static void freeCellSettle(void *state) {
+	while (EngineFreeCell.delay(state) != Forever) {
+		EngineFreeCell.step(state, Tick, NULL);
+	}
+}
+
+static void freeCellPlay(void *state) {
+	uint32_t head[2] = { FreeCellGame, 0 };
+	if (!EngineFreeCell.load(state, (byte *)head, sizeof(head))) {
+		errx(EX_SOFTWARE, "freecell: load");
+	}
+	for (size_t i = 0; i < freeCell.keysLen; ++i) {
+		EngineFreeCell.step(state, freeCell.keys[i], NULL);
+		freeCellSettle(state);
+	}
+}
+
+static void *freeCellState(void) {
+	void *state = calloc(1, EngineFreeCell.size);
+	if (!state) err(EX_OSERR, "calloc");
+	if (freeCell.keysLen) return state;
+	struct Solution *solution = malloc(sizeof(*solution));
+	if (!solution) err(EX_OSERR, "malloc");
+	struct Stack stacks[Stacks];
+	deal(stacks, FreeCellGame);
+	if (solve(solution, stacks, 0, 1 << 20) != Solved) {
+		errx(EX_SOFTWARE, "freecell: deal #%u unsolved", FreeCellGame);
+	}
+	freeCellKeys(solution);
+	free(solution);
+	freeCellPlay(state);
+	if (!EngineFreeCell.score(state)) {
+		warnx("freecell: deal #%u not won by its solution", FreeCellGame);
+	}
+	freeCell.saveLen = EngineFreeCell.save(
+		state, freeCell.save, sizeof(freeCell.save)
+	);
+	if (freeCell.saveLen > sizeof(freeCell.save)) {
+		errx(EX_SOFTWARE, "freecell: save too long");
+	}
+	return state;
+}
+
+static void benchFreeCellPlay(uint64_t n) {
+	void *state = freeCellState();
+	for (uint64_t i = 0; i < n; ++i) {
+		freeCellPlay(state);
+		sink = EngineFreeCell.score(state);
+	}
+	EngineFreeCell.fini(state);
+	free(state);
+}
+
+static void benchFreeCellLoad(uint64_t n) {
+	void *state = freeCellState();
+	for (uint64_t i = 0; i < n; ++i) {
+		sink = EngineFreeCell.load(state, freeCell.save, freeCell.saveLen);
+	}
+	EngineFreeCell.fini(state);
+	free(state);
+}
+
+// Renders alternate between two states so each frame has something to
+// send, to a terminal whose output goes nowhere.
+static void renderCurse(void) {
+	static SCREEN *screen;
+	if (screen) return;
+	FILE *out = fopen("/dev/null", "w");
+	FILE *in = fopen("/dev/null", "r");
+	if (!out || !in) err(EX_OSFILE, "/dev/null");
+	screen = newterm("xterm", out, in);
+	if (!screen) errx(EX_CONFIG, "newterm");
+	resizeterm(24, 80);
+	start_color();
+}
+
+static void benchRender(
+	uint64_t n, const struct Engine *engine, const int *keys, size_t len
+) {
+	renderCurse();
+	struct Rng rng;
+	rngSeed(&rng, 1);
+	void *state[2];
+	for (uint i = 0; i < 2; ++i) {
+		state[i] = calloc(1, engine->size);
+		if (!state[i]) err(EX_OSERR, "calloc");
+		engine->init(state[i], &rng);
+	}
+	static byte buf[8192];
+	size_t save = engine->save(state[0], buf, sizeof(buf));
+	if (save > sizeof(buf) || !engine->load(state[1], buf, save)) {
+		errx(EX_SOFTWARE, "render: save");
+	}
+	for (size_t i = 0; i < len; ++i) {
+		engine->step(state[1], keys[i], &rng);
+	}
+	for (uint64_t i = 0; i < n; ++i) {
+		engine->render(state[i % 2], DirtyAll);
+		refresh();
+	}
+	for (uint i = 0; i < 2; ++i) {
+		if (engine->fini) engine->fini(state[i]);
+		free(state[i]);
+	}
+}
+
+static void benchRender2048(uint64_t n) {
+	static const int Keys[] = { KEY_LEFT, KEY_UP };
+	benchRender(n, &Engine2048, Keys, ARRAY_LEN(Keys));
+}
+static void benchRenderSnake(uint64_t n) {
+	static const int Keys[] = { Tick, Tick, Tick };
+	benchRender(n, &EngineSnake, Keys, ARRAY_LEN(Keys));
+}
+static void benchRenderFreeCell(uint64_t n) {
+	static const int Keys[] = { 'q' };
+	benchRender(n, &EngineFreeCell, Keys, ARRAY_LEN(Keys));
+}
+
+static const struct Bench {
+	const char *name;
+	void (*fn)(uint64_t n);
+} Benches[] = {
+	{ "arc4random_uniform", benchArc4random },
+	{ "rngUniform/entropy", benchRngEntropy },
+	{ "rngUniform/seeded", benchRngSeeded },
+	{ "scoresInsert/full", benchScoresInsert },
+	{ "scoresAccum/full", benchScoresAccum },
+	{ "boardScore", benchBoardScore },
+	{ "gridMove/left", benchGridLeft },
+	{ "gridMove/right", benchGridRight },
+	{ "gridMove/up", benchGridUp },
+	{ "gridMove/down", benchGridDown },
+	{ "gridOver", benchGridOver },
+	{ "move/3x3", benchTiles3 },
+	{ "move/4x4", benchGridSized },
+	{ "move/5x5", benchTiles5 },
+	{ "move/6x6", benchTiles6 },
+	{ "move/8x8", benchTiles8 },
+	{ "wormTick/4", benchWorm4 },
+	{ "wormTick/64", benchWorm64 },
+	{ "wormTick/512", benchWorm512 },
+	{ "wormTick/1024", benchWorm1024 },
+	{ "freecell/deal", benchDeal },
+	{ "freecell/play", benchFreeCellPlay },
+	{ "freecell/load", benchFreeCellLoad },
+	{ "render/2048", benchRender2048 },
+	{ "render/snake", benchRenderSnake },
+	{ "render/freecell", benchRenderFreeCell },
+};
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare(const void *_a, const void *_b) {
+	const double *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+// Each bench is warmed up once. Without -n, it then doubles its count
+// until a run takes MinRun, so fast and slow paths alike are timed over
+// runs long enough to be stable. -t prints tab-separated values.
+enum { Runs = 9 };
+static const double MinRun = 0.02;
+
+static uint64_t calibrate(const struct Bench *bench) {
+	for (uint64_t n = 1;; n *= 2) {
+		double start = now();
+		bench->fn(n);
+		if (now() - start >= MinRun) return n;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	bool tsv = false;
+	const char *filter = NULL;
+	uint64_t fixed = 0;
+	for (int opt; 0 < (opt = getopt(argc, argv, "f:n:t"));) {
+		switch (opt) {
+			break; case 'f': filter = optarg;
+			break; case 'n': fixed = strtoull(optarg, NULL, 10);
+			break; case 't': tsv = true;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (tsv) printf("bench\tn\tmedian_ns\tmin_ns\tmax_ns\n");
+	for (uint i = 0; i < ARRAY_LEN(Benches); ++i) {
+		const struct Bench *bench = &Benches[i];
+		if (filter && !strstr(bench->name, filter)) continue;
+		bench->fn(1);
+		uint64_t n = (fixed ? fixed : calibrate(bench));
+		double runs[Runs];
+		for (uint r = 0; r < Runs; ++r) {
+			double start = now();
+			bench->fn(n);
+			runs[r] = (now() - start) * 1e9 / n;
+		}
+		qsort(runs, Runs, sizeof(runs[0]), compare);
+		if (tsv) {
+			printf(
+				"%s\t%ju\t%.2f\t%.2f\t%.2f\n", bench->name, (uintmax_t)n,
+				runs[Runs / 2], runs[0], runs[Runs - 1]
+			);
+		} else {
+			printf(
+				"%-24s median %10.2f ns/op  min %10.2f  max %10.2f\n",
+				bench->name, runs[Runs / 2], runs[0], runs[Runs - 1]
+			);
+		}
+		fflush(stdout);
+	}
+}
@@ -16,206 +16,216 @@
 
 #include <curses.h>
 #include <err.h>
-#include <fcntl.h>
 #include <locale.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/file.h>
 #include <sysexits.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <utils/arc4random.h>
+
 #ifdef __FreeBSD__
 #include <sys/capsicum.h>
 #endif
 
-#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
-
-typedef unsigned uint;
-
-enum { ScoresLen = 1000 };
-static struct Score {
-	time_t date;
-	uint score;
-	char name[32];
-} scores[ScoresLen];
-
-static FILE *scoresOpen(const char *path) {
-	int fd = open(path, O_RDWR | O_CREAT, 0644);
-	if (fd < 0) err(EX_CANTCREAT, "%s", path);
-	FILE *file = fdopen(fd, "r+");
-	if (!file) err(EX_CANTCREAT, "%s", path);
-	return file;
-}
-
-static void scoresLock(FILE *file) {
-	int error = flock(fileno(file), LOCK_EX);
-	if (error) err(EX_IOERR, "flock");
-}
-
-static void scoresRead(FILE *file) {
-	memset(scores, 0, sizeof(scores));
-	rewind(file);
-	fread(scores, sizeof(struct Score), ScoresLen, file);
-	if (ferror(file)) err(EX_IOERR, "fread");
-}
+#include "play.h"
 
-static void scoresWrite(FILE *file) {
-	rewind(file);
-	fwrite(scores, sizeof(struct Score), ScoresLen, file);
-	if (ferror(file)) err(EX_IOERR, "fwrite");
-}
-
-static size_t scoresInsert(struct Score new) {
-	if (!new.score) return ScoresLen;
-	for (size_t i = 0; i < ScoresLen; ++i) {
-		if (scores[i].score > new.score) continue;
-		memmove(
-			&scores[i + 1], &scores[i],
-			sizeof(struct Score) * (ScoresLen - i - 1)
-		);
-		scores[i] = new;
-		return i;
-	}
-	return ScoresLen;
-}
-
-static size_t scoresAccum(struct Score acc) {
-	if (!acc.score) return ScoresLen;
-	for (size_t i = 0; i < ScoresLen; ++i) {
-		if (strcmp(scores[i].name, acc.name)) continue;
-		scores[i].date = acc.date;
-		scores[i].score += acc.score;
-		while (i && scores[i-1].score < scores[i].score) {
-			acc = scores[i];
-			scores[i] = scores[i-1];
-			scores[--i] = acc;
-		}
-		return i;
-	}
-	size_t index = scoresInsert(acc);
-	if (index < ScoresLen) return index;
-	index = ScoresLen - 1;
-	scores[index] = acc;
-	return index;
-}
-
-static void curse(void) {
-	initscr();
-	cbreak();
+// The menu and scoreboards type into lines with a cursor. Games only
+// change the modes they need from these, and these are set back after.
+static void board(void) {
 	echo();
 	curs_set(1);
 	keypad(stdscr, true);
 	leaveok(stdscr, false);
-	start_color();
-	use_default_colors();
+	timeout(-1);
 	attr_set(A_NORMAL, 0, NULL);
 	erase();
 }
 
-enum {
-	RankWidth = 4,
-	ScoreWidth = 10,
-	NameWidth = 31,
-	DateWidth = 10,
-	BoardWidth = RankWidth + 2 + ScoreWidth + 2 + NameWidth + 2 + DateWidth,
-	BoardY = 0,
-	BoardX = 2,
-	NameX = BoardX + RankWidth + 2 + ScoreWidth + 2,
-	BoardLen = 15,
-};
-
-static char board[BoardWidth + 1];
-
-static char *boardTitle(const char *title) {
-	snprintf(
-		board, sizeof(board),
-		"%*s",
-		(int)(BoardWidth + strlen(title)) / 2, title
-	);
-	return board;
+// Sets up the one screen a session uses from the menu to the scoreboards.
+static void curse(void) {
+	initscr();
+	cbreak();
+	start_color();
+	use_default_colors();
+	board();
 }
 
-static char *boardLine(void) {
-	for (uint i = 0; i < BoardWidth; ++i) {
-		board[i] = '=';
+// Reads a name where the cursor is, unless one was already given.
+static void getName(char *name, size_t cap) {
+	while (!name[0]) {
+		int y, x;
+		getyx(stdscr, y, x);
+		getnstr(name, cap - 1);
+		move(y, x);
+	}
+	for (char *ch = name; *ch; ++ch) {
+		if (*ch < ' ') *ch = ' ';
 	}
-	board[BoardWidth] = '\0';
-	return board;
 }
 
-static char *boardScore(size_t i) {
-	struct tm *time = localtime(&scores[i].date);
-	if (!time) err(EX_SOFTWARE, "localtime");
-	char date[DateWidth + 1];
-	strftime(date, sizeof(date), "%F", time);
-	snprintf(
-		board, sizeof(board),
-		"%*zu. %*u  %-*s  %*s",
-		RankWidth, 1 + i,
-		ScoreWidth, scores[i].score,
-		NameWidth, scores[i].name,
-		DateWidth, date
-	);
-	return board;
+enum { KeyOK = KEY_MAX + 1 };
+
+static long long clockUsec(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-static void draw(const char *title, size_t new) {
-	mvaddstr(BoardY + 0, BoardX, boardTitle(title));
-	mvaddstr(BoardY + 1, BoardX, boardLine());
+// Counts the lines curses has to look at before it sends them.
+static void frame(void) {
+	uint lines = 0;
+	for (int y = 0; y < LINES; ++y) {
+		if (is_linetouched(stdscr, y)) lines++;
+	}
+	if (lines) metricsFrame(lines);
+	refresh();
+	flightRecord(FlightFlush, lines);
+}
 
-	int newY = -1;
-	for (size_t i = 0; i < BoardLen; ++i) {
-		if (!scores[i].score) break;
-		if (i == new) newY = BoardY + 2 + i;
-		attr_set(i == new ? A_BOLD : A_NORMAL, 0, NULL);
-		mvaddstr(BoardY + 2 + i, BoardX, boardScore(i));
+// Feeds keys and ticks to an engine and draws what they change. Ticks keep
+// their own schedule however many keys arrive in between. A sync engine
+// also waits for the terminal to answer a status report before each tick,
+// so a slow connection slows the game rather than falling behind it.
+static uint run(
+	const char *name, const struct Engine *engine, time_t date, uint64_t seed
+) {
+	void *state = calloc(1, engine->size);
+	if (!state) err(EX_OSERR, "calloc");
+	engine->curse();
+	if (engine->sync) define_key("\33[0n", KeyOK);
+	rngSeed(&sessionRng, seed);
+	engine->init(state, &sessionRng);
+	if (engine->save) {
+		static byte save[8192];
+		size_t len = engine->save(state, save, sizeof(save));
+		if (len <= sizeof(save)) recordStart(name, date, seed, save, len);
 	}
-	if (new == ScoresLen) return;
 
-	if (new >= BoardLen) {
-		newY = BoardY + BoardLen + 5;
-		mvaddstr(newY - 3, BoardX, boardLine());
-		mvaddstr(newY - 2, BoardX, boardScore(new - 2));
-		mvaddstr(newY - 1, BoardX, boardScore(new - 1));
-		attr_set(A_BOLD, 0, NULL);
-		mvaddstr(newY, BoardX, boardScore(new));
-		attr_set(A_NORMAL, 0, NULL);
-		if (new + 1 < ScoresLen && scores[new + 1].score) {
-			mvaddstr(newY + 1, BoardX, boardScore(new + 1));
+	bool synced = true;
+	long long deadline = -1;
+	uint events = DirtyAll;
+	while (!(events & EventDone)) {
+		engine->render(state, events & DirtyAll);
+		flightRecord(FlightDraw, events & DirtyAll);
+		frame();
+		if (events & EventOver) flushinp();
+
+		int delay = engine->delay(state);
+		if (delay == Forever) {
+			deadline = -1;
+		} else if (deadline < 0) {
+			deadline = clockUsec() + 1000LL * delay;
+			if (engine->sync) {
+				putp("\33[5n");
+				fflush(stdout);
+				flightRecord(FlightSync, 0);
+				synced = false;
+			}
 		}
-		if (new + 2 < ScoresLen && scores[new + 2].score) {
-			mvaddstr(newY + 2, BoardX, boardScore(new + 2));
+
+		int wait = Forever;
+		if (deadline >= 0) {
+			long long left = deadline - clockUsec();
+			if (left > 0) {
+				wait = (left + 999) / 1000;
+			} else if (synced) {
+				wait = 0;
+			}
+		}
+		timeout(wait);
+		int ch = getch();
+		if (ch == KeyOK) {
+			flightRecord(FlightSyncReply, 0);
+			synced = true;
+			events = 0;
+		} else if (ch != ERR) {
+			flightRecord(FlightKey, ch);
+			recordStep(ch);
+			events = engine->step(state, ch, &sessionRng);
+			tournamentScore(engine->score(state));
+		} else if (wait == Forever) {
+			flightDump();
+			exit(EXIT_FAILURE);
+		} else if (synced) {
+			long long late = clockUsec() - deadline;
+			metricsTickLate(late > 0 ? late : 0);
+			flightRecord(FlightTick, late > 0 ? late : 0);
+			deadline = -1;
+			int key = (engine->pick ? engine->pick(state) : Tick);
+			recordStep(key);
+			events = engine->step(state, key, &sessionRng);
+			flightRecord(FlightTickEnd, events);
+			tournamentScore(engine->score(state));
+		} else {
+			events = 0;
 		}
 	}
-	move(newY, NameX);
+
+	recordFlush();
+	uint score = engine->score(state);
+	if (engine->fini) engine->fini(state);
+	free(state);
+	return score;
 }
 
-typedef uint Play(void);
-uint play2048(void);
-uint playSnake(void);
-uint playFreeCell(void);
+typedef void Prep(void);
+void prepArena(void);
+void prepFreeCell(void);
+void replayFreeCell(FILE *file);
 
 static const struct Game {
 	const char *name;
 	const char *title;
 	const char *desc;
-	Play *play;
+	const struct Engine *engine;
 	bool cum;
+	Prep *prep;
 } Games[] = {
 	{
 		"2048", "2048", "Slide and merge matching tiles",
-		play2048, false,
+		&Engine2048, false, NULL,
 	},
 	{
 		"snake", "Snake", "Eat food before it spoils to become long",
-		playSnake, false,
+		&EngineSnake, false, NULL,
 	},
 	{
 		"freecell", "FreeCell", "Sort cards like it's 1995",
-		playFreeCell, true,
+		&EngineFreeCell, true, prepFreeCell,
+	},
+	{
+		"arena", "Arena", "Snake, but everyone plays in the same arena",
+		&EngineArena, false, prepArena,
+	},
+	{
+		"2048-3x3", "2048 3x3", "Slide and merge on a cramped board",
+		&Engine2048x3, false, NULL,
+	},
+	{
+		"2048-5x5", "2048 5x5", "Slide and merge on a roomier board",
+		&Engine2048x5, false, NULL,
+	},
+	{
+		"2048-6x6", "2048 6x6", "Slide and merge for a long while",
+		&Engine2048x6, false, NULL,
+	},
+	{
+		"2048-8x8", "2048 8x8", "Slide and merge for a very long while",
+		&Engine2048x8, false, NULL,
+	},
+	{
+		"freecell-easy", "FreeCell Easy", "Sort cards the solver found easy",
+		&EngineFreeCellEasy, true, prepFreeCell,
+	},
+	{
+		"freecell-hard", "FreeCell Hard", "Sort cards the solver found hard",
+		&EngineFreeCellHard, true, prepFreeCell,
 	},
 };
 
@@ -224,17 +234,19 @@ static const struct Game *menu(void) {
 	for (uint i = 0; cmd && i < ARRAY_LEN(Games); ++i) {
 		if (!strcmp(Games[i].name, cmd)) return &Games[i];
 	}
+	// Entries lose the line between them when they wouldn't all fit.
+	int gap = (LINES < 1 + 3 * (int)ARRAY_LEN(Games) ? 2 : 3);
 	uint game = 0;
 	for (;;) {
 		for (uint i = 0; i < ARRAY_LEN(Games); ++i) {
 			attrset(i == game ? A_STANDOUT : A_NORMAL);
 			char buf[256];
 			snprintf(buf, sizeof(buf), "%u. %s", 1 + i, Games[i].title);
-			mvaddstr(1 + 3 * i, 2, buf);
+			mvaddstr(1 + gap * i, 2, buf);
 			attrset(A_NORMAL);
-			mvaddstr(2 + 3 * i, 2, Games[i].desc);
+			mvaddstr(2 + gap * i, 2, Games[i].desc);
 		}
-		move(1 + 3 * game, 2);
+		move(1 + gap * game, 2);
 		int ch = getch();
 		switch (ch) {
 			break; case 'k': case KEY_UP: {
@@ -257,6 +269,47 @@ static const struct Game *menu(void) {
 	}
 }
 
+static int play(const char *path, double speed) {
+	FILE *file = fopen(path, "r");
+	if (!file) err(EX_NOINPUT, "%s", path);
+	struct Recording rec;
+	if (!recordLoad(&rec, file)) errx(EX_DATAERR, "%s: not a recording", path);
+	fclose(file);
+	if (speed <= 0) errx(EX_USAGE, "bad speed");
+	for (uint i = 0; i < ARRAY_LEN(Games); ++i) {
+		if (strcmp(Games[i].name, rec.head.game)) continue;
+		int status = recordPlay(&rec, Games[i].engine, speed, 0);
+		recordFree(&rec);
+		return status;
+	}
+	errx(EX_DATAERR, "%s: unknown game %s", path, rec.head.game);
+}
+
+// Both boards are read while the game runs, so that they're ready to rank
+// its score in the moment it ends. Only the final insert takes the lock.
+static struct ScoresAhead weeklyAhead, topAhead;
+
+static void *prefetch(void *ptr) {
+	FILE **boards = ptr;
+	scoresPrefetch(&weeklyAhead, boards[0]);
+	scoresPrefetch(&topAhead, boards[1]);
+	return NULL;
+}
+
+// Leaves a record of the session's last moments before dying of a signal.
+static void abnormal(int sig) {
+	flightDump();
+	recordFlush();
+	metricsAbort();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void flightSignal(int sig) {
+	(void)sig;
+	flightDump();
+}
+
 static void info(void) {
 	endwin();
 	printf(
@@ -268,9 +321,23 @@ static void info(void) {
 int main(int argc, char *argv[]) {
 	setlocale(LC_CTYPE, "en_US.UTF-8");
 
+	bool dash = false;
+	bool standings = false;
+	bool text = false;
+	double speed = 1;
 	const char *path = NULL;
-	for (int opt; 0 < (opt = getopt(argc, argv, "t:"));) {
+	const char *rollup = NULL;
+	const char *playback = NULL;
+	const char *replay = NULL;
+	for (int opt; 0 < (opt = getopt(argc, argv, "MSa:mp:r:s:t:"));) {
 		switch (opt) {
+			break; case 'M': text = true;
+			break; case 'S': standings = true;
+			break; case 'a': rollup = optarg;
+			break; case 'm': dash = true;
+			break; case 'p': playback = optarg;
+			break; case 'r': replay = optarg;
+			break; case 's': speed = strtod(optarg, NULL);
 			break; case 't': path = optarg;
 			break; default:  return EX_USAGE;
 		}
@@ -289,9 +356,36 @@ int main(int argc, char *argv[]) {
 		return EX_OK;
 	}
 
+	const char *names[ARRAY_LEN(Games)];
+	for (uint i = 0; i < ARRAY_LEN(Games); ++i) {
+		names[i] = Games[i].name;
+	}
+	if (text) {
+		return metricsShow("play.metrics", names, ARRAY_LEN(names), true);
+	}
+	if (rollup) {
+		return rollupsShow("play.rollups", names, ARRAY_LEN(names), rollup);
+	}
+
 	if (!isatty(STDOUT_FILENO)) {
 		errx(EX_USAGE, "not a tty; use ssh -t");
 	}
+	if (dash) {
+		return metricsShow("play.metrics", names, ARRAY_LEN(names), false);
+	}
+	const char *cmd = getenv("SSH_ORIGINAL_COMMAND");
+	if (standings || (cmd && !strcmp(cmd, "standings"))) {
+		return tournamentShow("play.tournament");
+	}
+	if (playback) {
+		return play(playback, speed);
+	}
+	if (replay) {
+		FILE *file = fopen(replay, "r");
+		if (!file) err(EX_NOINPUT, "%s", replay);
+		replayFreeCell(file);
+		return EX_OK;
+	}
 	curse();
 	atexit(info);
 
@@ -315,6 +409,23 @@ int main(int argc, char *argv[]) {
 	FILE *top = scoresOpen(buf);
 	snprintf(buf, sizeof(buf), "%s.weekly", game->name);
 	FILE *weekly = scoresOpen(buf);
+	if (game->prep) game->prep();
+	metricsOpen("play.metrics");
+	rollupsOpen("play.rollups");
+	uint64_t seed;
+	time_t closes;
+	bool entered = game->engine->save && tournamentJoin(
+		"play.tournament", game->name, &seed, &closes
+	);
+	if (!entered) arc4random_buf(&seed, sizeof(seed));
+	flightOpen("play.flight", game->name);
+	if (game->engine->save) recordOpen(game->name);
+	signal(SIGHUP, abnormal);
+	signal(SIGABRT, abnormal);
+	signal(SIGBUS, abnormal);
+	signal(SIGFPE, abnormal);
+	signal(SIGSEGV, abnormal);
+	signal(SIGUSR1, flightSignal);
 
 #ifdef __OpenBSD__
 	error = pledge("stdio tty flock", NULL);
@@ -326,7 +437,9 @@ int main(int argc, char *argv[]) {
 	if (error) err(EX_OSERR, "cap_enter");
 
 	cap_rights_t rights;
-	cap_rights_init(&rights, CAP_READ, CAP_WRITE, CAP_SEEK, CAP_FLOCK);
+	cap_rights_init(
+		&rights, CAP_READ, CAP_WRITE, CAP_SEEK, CAP_FLOCK, CAP_FSTAT, CAP_PREAD
+	);
 
 	error = cap_rights_limit(fileno(top), &rights);
 	if (error) err(EX_OSERR, "cap_rights_limit");
@@ -335,32 +448,49 @@ int main(int argc, char *argv[]) {
 	if (error) err(EX_OSERR, "cap_rights_limit");
 #endif
 
-	struct Score new = {
-		.date = time(NULL),
-		.score = game->play(),
-	};
-
-	curse();
-
-	scoresRead(weekly);
+	FILE *boards[2] = { weekly, top };
+	pthread_t prefetcher;
+	bool prefetching = !pthread_create(&prefetcher, NULL, prefetch, boards);
+	if (!prefetching) prefetch(boards);
+
+	struct Score new = {0};
+	if (entered) {
+		char until[sizeof("00:00")];
+		strftime(until, sizeof(until), "%H:%M", localtime(&closes));
+		mvaddstr(BoardY + 0, BoardX, boardTitle("TOURNAMENT"));
+		mvaddstr(BoardY + 1, BoardX, boardLine());
+		mvprintw(
+			BoardY + 3, BoardX, "Everyone plays the same %s until %s.",
+			game->title, until
+		);
+		mvaddstr(BoardY + 4, BoardX, "Your name: ");
+		attr_set(A_BOLD, 0, NULL);
+		getName(new.name, sizeof(new.name));
+		tournamentName(new.name);
+		board();
+	}
+	new.date = time(NULL);
+	metricsGameStart(game - Games);
+	new.score = run(game->name, game->engine, new.date, seed);
+	metricsGameEnd();
+	tournamentDone(new.score);
+	if (prefetching) pthread_join(prefetcher, NULL);
+	time_t end = time(NULL);
+	rollupsAdd(game - Games, end, end - new.date, new.score);
+
+	board();
+
+	scoresFetch(&weeklyAhead);
 	size_t index = scoresInsert(new);
 	if (game->cum && index == ScoresLen && new.score) {
 		index = ScoresLen - 1;
 		scores[index] = new;
 	}
-	draw("WEEKLY SCORES", index);
+	boardDraw("WEEKLY SCORES", index);
 
 	if (index < ScoresLen) {
 		attr_set(A_BOLD, 0, NULL);
-		while (!new.name[0]) {
-			int y, x;
-			getyx(stdscr, y, x);
-			getnstr(new.name, sizeof(new.name) - 1);
-			move(y, x);
-		}
-		for (char *ch = new.name; *ch; ++ch) {
-			if (*ch < ' ') *ch = ' ';
-		}
+		getName(new.name, sizeof(new.name));
 
 		scoresLock(weekly);
 		scoresRead(weekly);
@@ -371,22 +501,23 @@ int main(int argc, char *argv[]) {
 		}
 		scoresWrite(weekly);
 		fclose(weekly);
+		flightRecord(FlightUnlock, 0);
 	}
 	noecho();
 	curs_set(0);
 
 	erase();
-	draw("WEEKLY SCORES", index);
+	boardDraw("WEEKLY SCORES", index);
 	getch();
 	erase();
 
-	scoresRead(top);
+	scoresFetch(&topAhead);
 	if (game->cum) {
 		index = scoresAccum(new);
 	} else {
 		index = scoresInsert(new);
 	}
-	draw("TOP SCORES", index);
+	boardDraw("TOP SCORES", index);
 
 	if (index < ScoresLen) {
 		scoresLock(top);
@@ -398,6 +529,7 @@ int main(int argc, char *argv[]) {
 		}
 		scoresWrite(top);
 		fclose(top);
+		flightRecord(FlightUnlock, 0);
 	}
 
 	getch();
@@ -0,0 +1,453 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef unsigned uint;
+typedef unsigned char byte;
+
+enum { RngLen = 256 };
+struct Rng {
+	bool seeded;
+	uint64_t state;
+	uint len;
+	uint32_t buf[RngLen];
+};
+extern struct Rng sessionRng;
+
+void rngSeed(struct Rng *rng, uint64_t seed);
+void rngFill(struct Rng *rng);
+void rngRestore(struct Rng *rng, uint64_t state, uint len);
+uint rngUniform(struct Rng *rng, uint bound);
+
+static inline uint32_t rngNext(struct Rng *rng) {
+	if (!rng->len) rngFill(rng);
+	return rng->buf[RngLen - rng->len--];
+}
+
+// 2048 board packed as sixteen 4-bit exponents, cell (y, x) at nibble 4y+x.
+typedef uint64_t Grid;
+enum Dir { Left, Right, Up, Down, Dirs };
+
+void gridInit(void);
+Grid gridMove(Grid grid, enum Dir dir, uint *score);
+bool gridOver(Grid grid);
+Grid gridTranspose(Grid grid);
+Grid gridEmptyMask(Grid grid);
+uint gridEmpty(Grid grid);
+Grid gridPut(Grid grid, uint n, uint exp);
+Grid gridSpawn(Grid grid, struct Rng *rng);
+
+static inline uint gridTile(Grid grid, uint y, uint x) {
+	return grid >> (4 * (4 * y + x)) & 0xF;
+}
+
+// 2048 boards of other sizes up to 8x8, a word of 4-bit exponents per row,
+// cell (y, x) at nibble x of rows[y]. Rows past n are zero.
+enum { TilesMax = 8 };
+struct Tiles {
+	uint32_t rows[TilesMax];
+	uint n;
+};
+
+void tilesInit(void);
+struct Tiles tilesMove(struct Tiles tiles, enum Dir dir, uint *score);
+bool tilesEqual(struct Tiles a, struct Tiles b);
+bool tilesOver(struct Tiles tiles);
+uint tilesEmpty(struct Tiles tiles);
+struct Tiles tilesPut(struct Tiles tiles, uint n, uint exp);
+struct Tiles tilesSpawn(struct Tiles tiles, struct Rng *rng);
+
+static inline uint tilesTile(const struct Tiles *tiles, uint y, uint x) {
+	return tiles->rows[y] >> (4 * x) & 0xF;
+}
+
+struct Hint {
+	enum Dir dir;
+	uint depth;
+	uint64_t nodes;
+};
+struct Hint gridHint(Grid grid, uint budget);
+extern bool hintsOff;
+
+enum {
+	WormRows = 24,
+	WormCols = 48,
+	WormCap = WormRows * WormCols,
+	FoodCap = 25,
+	FoodChance = 15,
+	FoodRipe = WormRows + WormCols,
+	FoodSpoil = FoodRipe + WormCols,
+	FoodMulch = FoodSpoil * 10,
+};
+
+// Snake state. The body is a ring, segment 0 just behind the head, with a
+// bitmap of the cells it covers, one word per row.
+struct Worm {
+	uint score;
+	const char *over;
+	struct {
+		uint len;
+		uint first;
+		byte y[WormCap];
+		byte x[WormCap];
+		uint64_t bits[WormRows];
+	} body;
+	struct {
+		int y, x;
+		int dy, dx;
+	} head;
+	struct {
+		uint len;
+		byte y[FoodCap];
+		byte x[FoodCap];
+		uint age[FoodCap];
+		uint64_t bits[WormRows];
+	} food;
+	struct {
+		uint placed;
+		uint fresh;
+		uint ripe;
+		uint mulched;
+	} stats;
+};
+
+void wormInit(struct Worm *worm);
+void wormTick(struct Worm *worm, struct Rng *rng);
+void wormTurn(struct Worm *worm, int dy, int dx);
+
+static inline uint wormSegment(const struct Worm *worm, uint i) {
+	i += worm->body.first;
+	return (i < WormCap ? i : i - WormCap);
+}
+
+// FreeCell cards are suit | rank. The stacks are the four foundations,
+// the four cells and the eight tableau columns, in that order.
+typedef byte Card;
+enum {
+	A = 1,
+	J = 11,
+	Q = 12,
+	K = 13,
+	Rank = 0x0F,
+	Suit = 0x30,
+	Color = 0x10,
+	Club = 0x00,
+	Diamond = 0x10,
+	Spade = 0x20,
+	Heart = 0x30,
+};
+
+enum { StackCap = 52 };
+struct Stack {
+	byte len;
+	Card cards[StackCap];
+};
+
+enum {
+	Foundation,
+	Cell = Foundation + 4,
+	Tableau = Cell + 4,
+	Stacks = Tableau + 8,
+};
+
+void deal(struct Stack stacks[static Stacks], uint game);
+
+// Cards a supermove can carry through free cells and spare empty columns.
+static inline uint supermove(uint free, uint empty) {
+	return (free + 1) << empty;
+}
+
+// Solutions are user moves of len cards from src onto dst, each followed
+// by the safe foundation moves freecell.c makes on its own. A move onto
+// the foundations has dst Foundation, whichever one it lands on.
+enum { SolveLen = 256 };
+enum Solve { Solved, Unsolvable, GaveUp };
+struct Solution {
+	enum Solve result;
+	uint len;
+	uint64_t nodes;
+	struct {
+		byte dst, src, len;
+	} moves[SolveLen];
+};
+enum Solve solve(
+	struct Solution *solution, const struct Stack stacks[static Stacks],
+	uint budget, uint cap
+);
+
+// Solvability index written by deals.c: one bit per proven solvable deal,
+// deal n at bit n-1, then one difficulty byte per deal, 12·log2 of the
+// solver's nodes, or DealUnknown.
+enum { Deals = 32000, DealUnknown = 0xFF };
+struct Deals {
+	char magic[8];
+	byte solvable[(Deals + 7) / 8];
+	byte difficulty[Deals];
+};
+static const char DealsMagic[8] = "deals\0\0\1";
+
+// Scoreboards are files of ScoresLen records, highest score first, which
+// the board functions format into one shared line buffer. An entry is
+// ScoreVerified once verify replays a recording of its session.
+enum { ScoresLen = 1000 };
+enum { ScoreVerified = 1 << 0 };
+struct Score {
+	time_t date;
+	uint score;
+	char name[32];
+	uint flags;
+};
+extern struct Score scores[ScoresLen];
+
+FILE *scoresOpen(const char *path);
+void scoresLock(FILE *file);
+void scoresRead(FILE *file);
+void scoresWrite(FILE *file);
+size_t scoresInsert(struct Score new);
+size_t scoresAccum(struct Score acc);
+
+// A board read ahead, without the lock, which scoresFetch copies into
+// scores, or reads again if the file has changed since.
+struct ScoresAhead {
+	FILE *file;
+	bool read;
+	struct timespec mtime;
+	off_t size;
+	struct Score scores[ScoresLen];
+};
+void scoresPrefetch(struct ScoresAhead *ahead, FILE *file);
+void scoresFetch(struct ScoresAhead *ahead);
+
+enum {
+	RankWidth = 4,
+	ScoreWidth = 10,
+	NameWidth = 31,
+	DateWidth = 10,
+	BoardWidth = RankWidth + 2 + ScoreWidth + 2 + NameWidth + 2 + DateWidth,
+	BoardY = 0,
+	BoardX = 2,
+	NameX = BoardX + RankWidth + 2 + ScoreWidth + 2,
+	BoardLen = 15,
+};
+
+char *boardTitle(const char *title);
+char *boardLine(void);
+char *boardScore(size_t i);
+void boardDraw(const char *title, size_t new);
+
+// Live counters shared by every session through a mapped file. The
+// recording functions do nothing until metricsOpen succeeds.
+enum { MetricsGames = 8 };
+void metricsOpen(const char *path);
+void metricsGameStart(uint game);
+void metricsGameEnd(void);
+void metricsAbort(void);
+uint64_t metricsClock(void);
+void metricsLockWait(uint64_t start);
+void metricsFrame(uint lines);
+void metricsTickLate(uint64_t late);
+int metricsShow(
+	const char *path, const char *const names[], uint len, bool text
+);
+
+// Plain copies of histograms, for load to compare before and after.
+enum { MetricsBuckets = 32 };
+struct MetricsHist {
+	uint64_t count;
+	uint64_t buckets[MetricsBuckets];
+};
+bool metricsSample(
+	const char *path, struct MetricsHist *lock, struct MetricsHist *late
+);
+void metricsObserve(struct MetricsHist *hist, uint64_t value);
+uint64_t metricsQuantile(const struct MetricsHist *hist, double q);
+
+// Games per hour, day and week, with their duration and score histograms,
+// aggregated as each game finishes. Games are indexed as in metrics.
+void rollupsOpen(const char *path);
+void rollupsAdd(uint game, time_t end, uint64_t seconds, uint score);
+int rollupsShow(
+	const char *path, const char *const names[], uint len, const char *name
+);
+
+// Entrants of a tournament all play from its seed, and each publishes its
+// score to its own slot of a shared table, which the standings rank without
+// taking locks. The session functions do nothing unless tournamentJoin
+// succeeds.
+enum { TournamentSlots = 256 };
+bool tournamentJoin(
+	const char *path, const char *game, uint64_t *seed, time_t *end
+);
+void tournamentName(const char *name);
+void tournamentScore(uint score);
+void tournamentDone(uint score);
+int tournamentShow(const char *path);
+int tournamentOpen(
+	const char *path, const char *game, uint64_t seed, uint minutes
+);
+int tournamentClose(const char *path);
+int tournamentPrint(const char *path);
+
+// Each session records its latest events in a ring, appended to a file
+// as one record of a FlightHead and its events, oldest first, when it
+// ends abnormally or is asked to. flightDump is safe in signal handlers.
+enum FlightType {
+	FlightKey,
+	FlightTick,
+	FlightTickEnd,
+	FlightDraw,
+	FlightFlush,
+	FlightSync,
+	FlightSyncReply,
+	FlightLock,
+	FlightLocked,
+	FlightUnlock,
+	FlightTypes,
+};
+struct Flight {
+	uint64_t usec;
+	uint32_t type;
+	uint32_t arg;
+};
+enum { FlightLen = 4096 };
+struct FlightHead {
+	char magic[8];
+	uint32_t pid;
+	uint32_t len;
+	int64_t date;
+	char game[16];
+};
+static const char FlightMagic[8] = "flight\0\1";
+void flightOpen(const char *path, const char *game);
+void flightRecord(enum FlightType type, uint32_t arg);
+void flightDump(void);
+
+struct Engine;
+
+// Recorded sessions, for playing back through their engine. Archived
+// recordings also have keyframes, the engine's save and the Rng after
+// step steps, so that playback can seek without replaying from the start.
+// Their saves follow the keyframes, at offset from the end of the table.
+struct RecordHead {
+	char magic[8];
+	uint64_t seed;
+	int64_t date;
+	uint32_t save;
+	char game[20];
+};
+static const char RecordMagic[8] = "record\0\1";
+struct RecordStep {
+	uint64_t at;
+	int key;
+};
+struct Keyframe {
+	uint64_t rng;
+	uint32_t draws;
+	uint32_t step;
+	uint32_t offset;
+	uint32_t len;
+};
+struct Recording {
+	struct RecordHead head;
+	byte *data;
+	const byte *save;
+	size_t len;
+	struct RecordStep *steps;
+	const struct Keyframe *keys;
+	size_t keysLen;
+};
+void recordOpen(const char *game);
+void recordStart(
+	const char *game, time_t date, uint64_t seed, const byte *save, size_t len
+);
+void recordStep(int key);
+void recordFlush(void);
+const struct Engine *recordEngine(const char *game);
+bool recordParse(struct Recording *rec, const byte *data, size_t len);
+bool recordLoad(struct Recording *rec, FILE *file);
+void recordFree(struct Recording *rec);
+bool recordReset(
+	const struct Recording *rec, const struct Engine *engine,
+	void *state, struct Rng *rng
+);
+bool recordSeat(
+	const struct Recording *rec, const struct Engine *engine,
+	void *state, struct Rng *rng, const struct Keyframe *key, const byte *save
+);
+int recordPlay(
+	const struct Recording *rec, const struct Engine *engine,
+	double speed, size_t start
+);
+
+// A game engine keeps all of its state in one block of size bytes. step()
+// takes a key, or Tick when delay() milliseconds pass without one, and
+// returns the engine's own bits for the parts of the screen render() must
+// redraw, along with EventOver once the game ends and EventDone once the
+// player leaves it. Only curse() and render() touch the terminal. The
+// driver sets up the screen and its colors once, so curse() only changes
+// the input modes, cursor and color pairs the game needs. sync asks the
+// driver to wait for the terminal to catch up between ticks.
+// save() writes at most cap bytes and returns the length it needs, and
+// load() restores a saved state over one that init() has set up. pick()
+// chooses the key a tick plays for the player, which the driver records
+// and steps in its place, so that playback needn't choose it again.
+// fini(), pick(), save() and load() may be NULL.
+enum { Tick = -1, Forever = -1 };
+enum {
+	DirtyAll = (1 << 24) - 1,
+	EventOver = 1 << 24,
+	EventDone = 1 << 25,
+};
+struct Engine {
+	size_t size;
+	bool sync;
+	void (*curse)(void);
+	void (*init)(void *state, struct Rng *rng);
+	void (*fini)(void *state);
+	uint (*step)(void *state, int key, struct Rng *rng);
+	int (*pick)(const void *state);
+	int (*delay)(const void *state);
+	void (*render)(const void *state, uint dirty);
+	uint (*score)(const void *state);
+	size_t (*save)(const void *state, byte *buf, size_t cap);
+	bool (*load)(void *state, const byte *buf, size_t len);
+};
+
+static inline size_t saveCopy(
+	byte *buf, size_t cap, const void *data, size_t len
+) {
+	memcpy(buf, data, (len < cap ? len : cap));
+	return len;
+}
+
+extern const struct Engine Engine2048;
+extern const struct Engine Engine2048x3;
+extern const struct Engine Engine2048x5;
+extern const struct Engine Engine2048x6;
+extern const struct Engine Engine2048x8;
+extern const struct Engine EngineArena;
+extern const struct Engine EngineFreeCell;
+extern const struct Engine EngineFreeCellEasy;
+extern const struct Engine EngineFreeCellHard;
+extern const struct Engine EngineSnake;
@@ -0,0 +1,418 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// A recording is a RecordHead, the engine's state as saved right after
+// init, then each key or Tick given to step as two unsigned LEB128
+// numbers: milliseconds since the previous one, and the key plus one.
+// Since the session's Rng is seeded from the head, running the same
+// steps from the same state plays the same game.
+
+static int recordFD = -1;
+static struct {
+	size_t len;
+	byte buf[4096];
+} out;
+static long long recordLast;
+
+static long long clockMs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Safe to call from a signal handler.
+void recordFlush(void) {
+	if (recordFD < 0 || !out.len) return;
+	ssize_t n = write(recordFD, out.buf, out.len);
+	(void)n;
+	out.len = 0;
+}
+
+static void recordClose(void) {
+	recordFlush();
+	if (recordFD >= 0) close(recordFD);
+	recordFD = -1;
+}
+
+// Sessions are recorded only if the recordings directory exists.
+void recordOpen(const char *game) {
+	char path[256];
+	snprintf(
+		path, sizeof(path), "recordings/%s-%lld-%ld.rec",
+		game, (long long)time(NULL), (long)getpid()
+	);
+	recordFD = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (recordFD >= 0) atexit(recordClose);
+}
+
+static void put(const void *ptr, size_t len) {
+	const byte *bytes = ptr;
+	while (len) {
+		if (out.len == sizeof(out.buf)) recordFlush();
+		size_t n = sizeof(out.buf) - out.len;
+		if (n > len) n = len;
+		memcpy(&out.buf[out.len], bytes, n);
+		out.len += n;
+		bytes += n;
+		len -= n;
+	}
+}
+
+static void putNum(uint64_t num) {
+	byte buf[10];
+	size_t len = 0;
+	do {
+		buf[len] = num & 0x7F;
+		num >>= 7;
+		if (num) buf[len] |= 0x80;
+		len++;
+	} while (num);
+	put(buf, len);
+}
+
+void recordStart(
+	const char *game, time_t date, uint64_t seed, const byte *save, size_t len
+) {
+	if (recordFD < 0) return;
+	struct RecordHead head = {
+		.seed = seed,
+		.date = date,
+		.save = len,
+	};
+	memcpy(head.magic, RecordMagic, sizeof(RecordMagic));
+	strncpy(head.game, game, sizeof(head.game) - 1);
+	put(&head, sizeof(head));
+	put(save, len);
+	recordLast = clockMs();
+}
+
+void recordStep(int key) {
+	if (recordFD < 0) return;
+	long long now = clockMs();
+	putNum(now - recordLast);
+	putNum(key + 1);
+	recordLast = now;
+}
+
+static bool getNum(const byte **ptr, const byte *end, uint64_t *num) {
+	*num = 0;
+	for (uint shift = 0; *ptr < end && shift < 64; shift += 7) {
+		byte b = *(*ptr)++;
+		*num |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+static const struct {
+	const char *name;
+	const struct Engine *engine;
+} Engines[] = {
+	{ "2048", &Engine2048 },
+	{ "2048-3x3", &Engine2048x3 },
+	{ "2048-5x5", &Engine2048x5 },
+	{ "2048-6x6", &Engine2048x6 },
+	{ "2048-8x8", &Engine2048x8 },
+	{ "freecell", &EngineFreeCell },
+	{ "freecell-easy", &EngineFreeCellEasy },
+	{ "freecell-hard", &EngineFreeCellHard },
+	{ "snake", &EngineSnake },
+};
+
+const struct Engine *recordEngine(const char *game) {
+	for (uint i = 0; i < ARRAY_LEN(Engines); ++i) {
+		if (!strcmp(Engines[i].name, game)) return Engines[i].engine;
+	}
+	return NULL;
+}
+
+// Parses a recording in place, without taking ownership of data.
+bool recordParse(struct Recording *rec, const byte *data, size_t len) {
+	*rec = (struct Recording) {0};
+	if (len < sizeof(rec->head)) return false;
+	memcpy(&rec->head, data, sizeof(rec->head));
+	if (memcmp(rec->head.magic, RecordMagic, sizeof(RecordMagic))) {
+		return false;
+	}
+	if (rec->head.save > len - sizeof(rec->head)) return false;
+	rec->head.game[sizeof(rec->head.game) - 1] = '\0';
+	rec->save = &data[sizeof(rec->head)];
+
+	const byte *ptr = rec->save + rec->head.save, *end = &data[len];
+	size_t cap = 0;
+	uint64_t at = 0;
+	for (;;) {
+		uint64_t delta, key;
+		if (!getNum(&ptr, end, &delta) || !getNum(&ptr, end, &key)) break;
+		if (rec->len == cap) {
+			cap = (cap ? cap * 2 : 1024);
+			rec->steps = realloc(rec->steps, sizeof(*rec->steps) * cap);
+			if (!rec->steps) err(EX_OSERR, "realloc");
+		}
+		at += delta;
+		rec->steps[rec->len++] = (struct RecordStep) {
+			.at = at,
+			.key = (int)key - 1,
+		};
+	}
+	return true;
+}
+
+bool recordLoad(struct Recording *rec, FILE *file) {
+	byte *data = NULL;
+	size_t cap = 0, len = 0;
+	for (;;) {
+		if (len == cap) {
+			cap = (cap ? cap * 2 : 4096);
+			data = realloc(data, cap);
+			if (!data) err(EX_OSERR, "realloc");
+		}
+		size_t n = fread(&data[len], 1, cap - len, file);
+		if (!n) break;
+		len += n;
+	}
+	if (ferror(file)) err(EX_IOERR, "fread");
+	bool ok = recordParse(rec, data, len);
+	rec->data = data;
+	return ok;
+}
+
+void recordFree(struct Recording *rec) {
+	free(rec->data);
+	free(rec->steps);
+	*rec = (struct Recording) {0};
+}
+
+// Hints search against the clock, so they're off while replaying.
+static bool seat(
+	const struct Recording *rec, const struct Engine *engine,
+	void *state, struct Rng *rng, const byte *save, size_t len
+) {
+	hintsOff = true;
+	if (engine->fini) engine->fini(state);
+	memset(state, 0, engine->size);
+	rngSeed(rng, rec->head.seed);
+	engine->init(state, rng);
+	return engine->load(state, save, len);
+}
+
+// Sets a state up as it was at the start of a recording.
+bool recordReset(
+	const struct Recording *rec, const struct Engine *engine,
+	void *state, struct Rng *rng
+) {
+	return seat(rec, engine, state, rng, rec->save, rec->head.save);
+}
+
+// Sets a state up as it was at a keyframe with its save.
+bool recordSeat(
+	const struct Recording *rec, const struct Engine *engine,
+	void *state, struct Rng *rng, const struct Keyframe *key, const byte *save
+) {
+	if (!seat(rec, engine, state, rng, save, key->len)) return false;
+	rngRestore(rng, key->rng, key->draws);
+	return true;
+}
+
+static struct {
+	const struct Recording *rec;
+	const struct Engine *engine;
+	void *state;
+	struct Rng rng;
+	size_t next;
+	size_t key;
+	bool keyed;
+	uint64_t at;
+	long long base;
+	double speed;
+	bool paused;
+	bool done;
+} play;
+
+// Where the recording is now, going by the wall clock since base.
+static uint64_t playAt(void) {
+	if (play.paused) return play.at;
+	return play.at + (clockMs() - play.base) * play.speed;
+}
+
+static void playRebase(void) {
+	play.at = playAt();
+	play.base = clockMs();
+}
+
+static uint64_t stepAt(size_t step) {
+	return (step ? play.rec->steps[step - 1].at : 0);
+}
+
+static void playKey(size_t i) {
+	const struct Recording *rec = play.rec;
+	const struct Keyframe *key = &rec->keys[i];
+	const byte *save = (const byte *)&rec->keys[rec->keysLen] + key->offset;
+	if (!recordSeat(rec, play.engine, play.state, &play.rng, key, save)) {
+		errx(EX_DATAERR, "recording has a bad keyframe");
+	}
+	play.next = key->step;
+	play.key = i + 1;
+	play.keyed = true;
+	play.done = false;
+}
+
+// A state seated from a keyframe is only known to play the same as the
+// recording up to the next one, so it's seated again there.
+static uint playStep(void) {
+	if (
+		play.keyed && play.key < play.rec->keysLen &&
+		play.rec->keys[play.key].step == play.next
+	) {
+		playKey(play.key);
+	}
+	const struct RecordStep *step = &play.rec->steps[play.next++];
+	uint events = play.engine->step(play.state, step->key, &play.rng);
+	if (events & EventDone) play.done = true;
+	return events;
+}
+
+// Seeks from the last keyframe before the target, or from the start, by
+// running every step up to the target without drawing.
+static void playSeek(uint64_t at) {
+	size_t key = play.rec->keysLen;
+	while (key && stepAt(play.rec->keys[key - 1].step) > at) key--;
+	bool back = at < play.at || play.done;
+	if (key && (back || play.rec->keys[key - 1].step > play.next)) {
+		playKey(key - 1);
+	} else if (back) {
+		if (!recordReset(play.rec, play.engine, play.state, &play.rng)) {
+			errx(EX_DATAERR, "recording has a bad save");
+		}
+		play.next = 0;
+		play.key = 0;
+		play.keyed = false;
+		play.done = false;
+	}
+	while (
+		!play.done && play.next < play.rec->len &&
+		play.rec->steps[play.next].at <= at
+	) {
+		playStep();
+	}
+	play.at = at;
+	play.base = clockMs();
+}
+
+static void playStatus(void) {
+	uint64_t end = stepAt(play.rec->len);
+	uint64_t at = playAt();
+	if (at > end) at = end;
+	char buf[128];
+	snprintf(
+		buf, sizeof(buf),
+		"%s %.2fx %.1f/%.1f s  space pause, +/- speed, arrows seek, q quit",
+		(play.paused ? "Paused" : "Playing"), play.speed, at / 1e3, end / 1e3
+	);
+	attr_set(A_REVERSE, 0, NULL);
+	mvaddstr(LINES - 1, 0, buf);
+	clrtoeol();
+	attr_set(A_NORMAL, 0, NULL);
+}
+
+enum { SeekMs = 10000 };
+
+// Plays a recording from just after step start.
+int recordPlay(
+	const struct Recording *rec, const struct Engine *engine,
+	double speed, size_t start
+) {
+	play.rec = rec;
+	play.engine = engine;
+	play.speed = speed;
+	play.state = calloc(1, engine->size);
+	if (!play.state) err(EX_OSERR, "calloc");
+	initscr();
+	cbreak();
+	start_color();
+	use_default_colors();
+	engine->curse();
+	keypad(stdscr, true);
+	play.done = true;
+	playSeek(stepAt(start < rec->len ? start : rec->len));
+
+	uint dirty = DirtyAll;
+	for (;;) {
+		if (dirty & DirtyAll) engine->render(play.state, dirty & DirtyAll);
+		playStatus();
+		refresh();
+		dirty = 0;
+
+		int wait = Forever;
+		bool ended = play.done || play.next == rec->len;
+		if (!play.paused && !ended) {
+			long long left = rec->steps[play.next].at - playAt();
+			wait = (left > 0 ? left / play.speed : 0);
+		} else if (!play.paused) {
+			wait = 100;
+		}
+		timeout(wait);
+		int ch = getch();
+		if (ch == ERR) {
+			if (!ended) dirty = playStep();
+			continue;
+		}
+		uint64_t at = playAt();
+		switch (ch) {
+			break; case 'q': goto done;
+			break; case ' ': {
+				playRebase();
+				play.paused ^= true;
+			}
+			break; case '+': {
+				playRebase();
+				if (play.speed < 64) play.speed *= 2;
+			}
+			break; case '-': {
+				playRebase();
+				if (play.speed > 1.0 / 64) play.speed /= 2;
+			}
+			break; case KEY_LEFT: case KEY_RIGHT: {
+				if (ch == KEY_LEFT) {
+					at = (at > SeekMs ? at - SeekMs : 0);
+				} else {
+					at += SeekMs;
+				}
+				playSeek(at);
+				erase();
+				dirty = DirtyAll;
+			}
+		}
+	}
+done:
+	endwin();
+	if (engine->fini) engine->fini(play.state);
+	free(play.state);
+	return EX_OK;
+}
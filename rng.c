@@ -0,0 +1,82 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <utils/arc4random.h>
+
+#include "play.h"
+
+struct Rng sessionRng;
+
+// A zeroed Rng draws from arc4random_buf a block at a time. A seeded Rng
+// fills its block from SplitMix64 (Steele, Lea & Flood, 2014) instead,
+// high 32 bits then low 32 bits of each output, so the same seed always
+// gives the same draws on every platform.
+
+void rngSeed(struct Rng *rng, uint64_t seed) {
+	rng->seeded = true;
+	rng->state = seed;
+	rng->len = 0;
+}
+
+static const uint64_t Golden = 0x9E3779B97F4A7C15;
+
+static uint64_t splitmix(uint64_t *state) {
+	uint64_t z = (*state += Golden);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+	return z ^ (z >> 31);
+}
+
+void rngFill(struct Rng *rng) {
+	if (rng->seeded) {
+		for (uint i = 0; i < RngLen; i += 2) {
+			uint64_t z = splitmix(&rng->state);
+			rng->buf[i + 0] = z >> 32;
+			rng->buf[i + 1] = z;
+		}
+	} else {
+		arc4random_buf(rng->buf, sizeof(rng->buf));
+	}
+	rng->len = RngLen;
+}
+
+// A seeded block is a function of the state that filled it, so a seeded
+// Rng can be put back from just its state and how many draws are left.
+void rngRestore(struct Rng *rng, uint64_t state, uint len) {
+	rng->seeded = true;
+	rng->state = state;
+	if (len) {
+		rng->state -= RngLen / 2 * Golden;
+		rngFill(rng);
+	}
+	rng->len = len;
+}
+
+// Lemire's multiply-shift with rejection, unbiased for any bound.
+uint rngUniform(struct Rng *rng, uint bound) {
+	uint64_t m = (uint64_t)rngNext(rng) * bound;
+	if ((uint32_t)m < bound) {
+		uint32_t min = -bound % bound;
+		while ((uint32_t)m < min) {
+			m = (uint64_t)rngNext(rng) * bound;
+		}
+	}
+	return m >> 32;
+}
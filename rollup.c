@@ -0,0 +1,248 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Finished games are added straight into hourly, daily and weekly rings
+// of pre-aggregated cells, so the file never grows and reading any period
+// costs the same however long it has been collecting. A ring slot belongs
+// to one period number and is cleared when a later period reuses it.
+// Histogram bucket i counts values up to 2^i, as in metrics.
+
+enum {
+	SecondsBuckets = 16,
+	ScoreBuckets = MetricsBuckets,
+};
+
+struct Cell {
+	uint32_t games;
+	uint32_t maxScore;
+	uint64_t seconds;
+	uint64_t score;
+	uint32_t secondsHist[SecondsBuckets];
+	uint32_t scoreHist[ScoreBuckets];
+};
+
+struct Slot {
+	int64_t period;
+	struct Cell games[MetricsGames];
+};
+
+enum { Hour = 60 * 60, Day = 24 * Hour, Week = 7 * Day };
+enum { HourSlots = 62 * 24, DaySlots = 2 * 366, WeekSlots = 10 * 52 };
+
+static const struct Ring {
+	const char *name;
+	uint len;
+	int64_t secs;
+	// Shifts period boundaries, so that weeks start on Monday.
+	int64_t offset;
+} Rings[] = {
+	{ "hour", HourSlots, Hour, 0 },
+	{ "day", DaySlots, Day, 0 },
+	{ "week", WeekSlots, Week, 3 * Day },
+};
+
+static const char Magic[8] = "rollup\0\1";
+
+struct Rollups {
+	char magic[8];
+	struct Slot hours[HourSlots];
+	struct Slot days[DaySlots];
+	struct Slot weeks[WeekSlots];
+};
+
+static struct Slot *ringSlots(struct Rollups *map, uint ring) {
+	switch (ring) {
+		case 0:  return map->hours;
+		case 1:  return map->days;
+		default: return map->weeks;
+	}
+}
+
+static int64_t period(const struct Ring *ring, time_t date) {
+	return ((int64_t)date + ring->offset) / ring->secs;
+}
+
+static uint bucket(uint64_t value, uint len) {
+	uint i = (value > 1 ? 64 - __builtin_clzll(value - 1) : 0);
+	return (i < len ? i : len - 1);
+}
+
+static struct {
+	int fd;
+	struct Rollups *map;
+} rollups = { .fd = -1 };
+
+static struct Rollups *rollupsMap(int fd, bool write) {
+	struct Rollups *map = NULL;
+	struct stat st;
+	int error = fstat(fd, &st);
+	if (write && !error && st.st_size != sizeof(*map)) {
+		error = ftruncate(fd, 0) || ftruncate(fd, sizeof(*map));
+	} else if (!error && st.st_size != sizeof(*map)) {
+		return NULL;
+	}
+	if (error) return NULL;
+	map = mmap(
+		NULL, sizeof(*map), PROT_READ | (write ? PROT_WRITE : 0), MAP_SHARED,
+		fd, 0
+	);
+	if (map == MAP_FAILED) return NULL;
+	if (memcmp(map->magic, Magic, sizeof(Magic))) {
+		if (!write) {
+			munmap(map, sizeof(*map));
+			return NULL;
+		}
+		memset(map, 0, sizeof(*map));
+		memcpy(map->magic, Magic, sizeof(Magic));
+	}
+	return map;
+}
+
+// Sessions run without rollups if the file can't be opened. The
+// descriptor stays open to lock around each addition.
+void rollupsOpen(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return;
+	int error = flock(fd, LOCK_EX);
+	if (!error) rollups.map = rollupsMap(fd, true);
+	flock(fd, LOCK_UN);
+	if (!rollups.map) {
+		close(fd);
+		return;
+	}
+	rollups.fd = fd;
+}
+
+void rollupsAdd(uint game, time_t end, uint64_t seconds, uint score) {
+	if (!rollups.map || game >= MetricsGames) return;
+	if (flock(rollups.fd, LOCK_EX)) return;
+	for (uint i = 0; i < ARRAY_LEN(Rings); ++i) {
+		const struct Ring *ring = &Rings[i];
+		int64_t p = period(ring, end);
+		struct Slot *slot = &ringSlots(rollups.map, i)[p % ring->len];
+		if (slot->period != p) {
+			memset(slot, 0, sizeof(*slot));
+			slot->period = p;
+		}
+		struct Cell *cell = &slot->games[game];
+		cell->games++;
+		if (score > cell->maxScore) cell->maxScore = score;
+		cell->seconds += seconds;
+		cell->score += score;
+		cell->secondsHist[bucket(seconds, SecondsBuckets)]++;
+		cell->scoreHist[bucket(score, ScoreBuckets)]++;
+	}
+	flock(rollups.fd, LOCK_UN);
+}
+
+static void copyHist(
+	struct MetricsHist *copy, const uint32_t *buckets, uint len
+) {
+	*copy = (struct MetricsHist) {0};
+	for (uint i = 0; i < len; ++i) {
+		copy->count += buckets[i];
+		copy->buckets[i] = buckets[i];
+	}
+}
+
+static void printRow(
+	FILE *file, const struct Ring *ring, int64_t p, const char *name,
+	const struct Cell *cell
+) {
+	char date[32];
+	time_t t = p * ring->secs - ring->offset;
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%MZ", gmtime(&t));
+	struct MetricsHist seconds, score;
+	copyHist(&seconds, cell->secondsHist, SecondsBuckets);
+	copyHist(&score, cell->scoreHist, ScoreBuckets);
+	fprintf(
+		file, "%s\t%s\t%" PRIu32 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+		"\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu32 "\t",
+		date, name, cell->games,
+		cell->seconds, metricsQuantile(&seconds, 0.5),
+		metricsQuantile(&seconds, 0.99),
+		cell->score, metricsQuantile(&score, 0.5),
+		metricsQuantile(&score, 0.99), cell->maxScore
+	);
+	const char *sep = "";
+	for (uint i = 0; i < ScoreBuckets; ++i) {
+		if (!cell->scoreHist[i]) continue;
+		fprintf(
+			file, "%s%" PRIu64 ":%" PRIu32,
+			sep, (uint64_t)1 << i, cell->scoreHist[i]
+		);
+		sep = ",";
+	}
+	fprintf(file, "\n");
+}
+
+// Prints each game of each period still in the named ring, oldest first,
+// as tab-separated values with a header line. Score histogram buckets are
+// listed as upper bound and count.
+int rollupsShow(
+	const char *path, const char *const names[], uint len, const char *name
+) {
+	uint r;
+	for (r = 0; r < ARRAY_LEN(Rings); ++r) {
+		if (!strcmp(name, Rings[r].name)) break;
+	}
+	if (r == ARRAY_LEN(Rings)) {
+		errx(EX_USAGE, "%s: not hour, day or week", name);
+	}
+	const struct Ring *ring = &Rings[r];
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) err(EX_NOINPUT, "%s", path);
+	int error = flock(fd, LOCK_SH);
+	if (error) err(EX_IOERR, "flock");
+	struct Rollups *map = rollupsMap(fd, false);
+	if (!map) errx(EX_NOINPUT, "%s: no rollups", path);
+
+	printf(
+		"%s\tgame\tgames\tseconds\tseconds p50\tseconds p99"
+		"\tscore\tscore p50\tscore p99\tscore max\tscores\n",
+		ring->name
+	);
+	const struct Slot *slots = ringSlots(map, r);
+	int64_t now = period(ring, time(NULL));
+	for (int64_t p = now - ring->len + 1; p <= now; ++p) {
+		const struct Slot *slot = &slots[p % ring->len];
+		if (slot->period != p) continue;
+		for (uint i = 0; i < len && i < MetricsGames; ++i) {
+			if (!slot->games[i].games) continue;
+			printRow(stdout, ring, p, names[i], &slot->games[i]);
+		}
+	}
+	munmap(map, sizeof(*map));
+	close(fd);
+	return (ferror(stdout) ? EX_IOERR : EX_OK);
+}
@@ -0,0 +1,193 @@
+/* Copyright (C) 2018, 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+struct Score scores[ScoresLen];
+
+FILE *scoresOpen(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) err(EX_CANTCREAT, "%s", path);
+	FILE *file = fdopen(fd, "r+");
+	if (!file) err(EX_CANTCREAT, "%s", path);
+	return file;
+}
+
+void scoresLock(FILE *file) {
+	uint64_t start = metricsClock();
+	flightRecord(FlightLock, 0);
+	int error = flock(fileno(file), LOCK_EX);
+	flightRecord(FlightLocked, 0);
+	metricsLockWait(start);
+	if (error) err(EX_IOERR, "flock");
+}
+
+void scoresRead(FILE *file) {
+	memset(scores, 0, sizeof(scores));
+	rewind(file);
+	fread(scores, sizeof(struct Score), ScoresLen, file);
+	if (ferror(file)) err(EX_IOERR, "fread");
+}
+
+void scoresWrite(FILE *file) {
+	rewind(file);
+	fwrite(scores, sizeof(struct Score), ScoresLen, file);
+	if (ferror(file)) err(EX_IOERR, "fwrite");
+}
+
+// Reads with pread, so that the file's stream is left alone for whoever
+// else uses it meanwhile.
+void scoresPrefetch(struct ScoresAhead *ahead, FILE *file) {
+	ahead->file = file;
+	ahead->read = false;
+	struct stat st;
+	if (fstat(fileno(file), &st)) return;
+	memset(ahead->scores, 0, sizeof(ahead->scores));
+	ssize_t len = pread(fileno(file), ahead->scores, sizeof(ahead->scores), 0);
+	if (len < 0) return;
+	ahead->mtime = st.st_mtim;
+	ahead->size = st.st_size;
+	ahead->read = true;
+}
+
+void scoresFetch(struct ScoresAhead *ahead) {
+	struct stat st;
+	if (
+		!ahead->read || fstat(fileno(ahead->file), &st) ||
+		st.st_size != ahead->size ||
+		st.st_mtim.tv_sec != ahead->mtime.tv_sec ||
+		st.st_mtim.tv_nsec != ahead->mtime.tv_nsec
+	) {
+		scoresRead(ahead->file);
+		return;
+	}
+	memcpy(scores, ahead->scores, sizeof(scores));
+}
+
+size_t scoresInsert(struct Score new) {
+	if (!new.score) return ScoresLen;
+	for (size_t i = 0; i < ScoresLen; ++i) {
+		if (scores[i].score > new.score) continue;
+		memmove(
+			&scores[i + 1], &scores[i],
+			sizeof(struct Score) * (ScoresLen - i - 1)
+		);
+		scores[i] = new;
+		return i;
+	}
+	return ScoresLen;
+}
+
+size_t scoresAccum(struct Score acc) {
+	if (!acc.score) return ScoresLen;
+	for (size_t i = 0; i < ScoresLen; ++i) {
+		if (strcmp(scores[i].name, acc.name)) continue;
+		scores[i].date = acc.date;
+		scores[i].score += acc.score;
+		scores[i].flags &= ~ScoreVerified;
+		while (i && scores[i-1].score < scores[i].score) {
+			acc = scores[i];
+			scores[i] = scores[i-1];
+			scores[--i] = acc;
+		}
+		return i;
+	}
+	size_t index = scoresInsert(acc);
+	if (index < ScoresLen) return index;
+	index = ScoresLen - 1;
+	scores[index] = acc;
+	return index;
+}
+
+static char board[BoardWidth + 1];
+
+char *boardTitle(const char *title) {
+	snprintf(
+		board, sizeof(board),
+		"%*s",
+		(int)(BoardWidth + strlen(title)) / 2, title
+	);
+	return board;
+}
+
+char *boardLine(void) {
+	for (uint i = 0; i < BoardWidth; ++i) {
+		board[i] = '=';
+	}
+	board[BoardWidth] = '\0';
+	return board;
+}
+
+char *boardScore(size_t i) {
+	struct tm *time = localtime(&scores[i].date);
+	if (!time) err(EX_SOFTWARE, "localtime");
+	char date[DateWidth + 1];
+	strftime(date, sizeof(date), "%F", time);
+	snprintf(
+		board, sizeof(board),
+		"%*zu. %*u%c %-*s  %*s",
+		RankWidth, 1 + i,
+		ScoreWidth, scores[i].score,
+		(scores[i].flags & ScoreVerified ? '*' : ' '),
+		NameWidth, scores[i].name,
+		DateWidth, date
+	);
+	return board;
+}
+
+// Draws the top of the board, and the new entry with its neighbours if it
+// ranks below that, leaving the cursor where its name goes.
+void boardDraw(const char *title, size_t new) {
+	mvaddstr(BoardY + 0, BoardX, boardTitle(title));
+	mvaddstr(BoardY + 1, BoardX, boardLine());
+
+	int newY = -1;
+	for (size_t i = 0; i < BoardLen; ++i) {
+		if (!scores[i].score) break;
+		if (i == new) newY = BoardY + 2 + i;
+		attr_set(i == new ? A_BOLD : A_NORMAL, 0, NULL);
+		mvaddstr(BoardY + 2 + i, BoardX, boardScore(i));
+	}
+	if (new == ScoresLen) return;
+
+	if (new >= BoardLen) {
+		newY = BoardY + BoardLen + 5;
+		mvaddstr(newY - 3, BoardX, boardLine());
+		mvaddstr(newY - 2, BoardX, boardScore(new - 2));
+		mvaddstr(newY - 1, BoardX, boardScore(new - 1));
+		attr_set(A_BOLD, 0, NULL);
+		mvaddstr(newY, BoardX, boardScore(new));
+		attr_set(A_NORMAL, 0, NULL);
+		if (new + 1 < ScoresLen && scores[new + 1].score) {
+			mvaddstr(newY + 1, BoardX, boardScore(new + 1));
+		}
+		if (new + 2 < ScoresLen && scores[new + 2].score) {
+			mvaddstr(newY + 2, BoardX, boardScore(new + 2));
+		}
+	}
+	move(newY, NameX);
+}
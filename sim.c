@@ -0,0 +1,345 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+typedef enum Dir Policy(Grid grid, struct Rng *rng);
+
+static enum Dir policyRandom(Grid grid, struct Rng *rng) {
+	enum Dir valid[Dirs];
+	uint len = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		if (gridMove(grid, dir, NULL) != grid) valid[len++] = dir;
+	}
+	return valid[rngUniform(rng, len)];
+}
+
+static enum Dir policyGreedy(Grid grid, struct Rng *rng) {
+	(void)rng;
+	enum Dir best = Dirs;
+	uint bestValue = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		uint score = 0;
+		Grid next = gridMove(grid, dir, &score);
+		if (next == grid) continue;
+		uint value = 1 + 16 * score + gridEmpty(next);
+		if (value > bestValue) {
+			best = dir;
+			bestValue = value;
+		}
+	}
+	return best;
+}
+
+static enum Dir policyCorner(Grid grid, struct Rng *rng) {
+	(void)rng;
+	static const enum Dir Order[Dirs] = { Down, Left, Right, Up };
+	for (uint i = 0; i < Dirs; ++i) {
+		if (gridMove(grid, Order[i], NULL) != grid) return Order[i];
+	}
+	return Dirs;
+}
+
+// The same policies for the other sizes, through tiles.c.
+typedef enum Dir TilesPolicy(struct Tiles tiles, struct Rng *rng);
+
+static enum Dir tilesRandom(struct Tiles tiles, struct Rng *rng) {
+	enum Dir valid[Dirs];
+	uint len = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		struct Tiles next = tilesMove(tiles, dir, NULL);
+		if (!tilesEqual(next, tiles)) valid[len++] = dir;
+	}
+	return valid[rngUniform(rng, len)];
+}
+
+static enum Dir tilesGreedy(struct Tiles tiles, struct Rng *rng) {
+	(void)rng;
+	enum Dir best = Dirs;
+	uint bestValue = 0;
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		uint score = 0;
+		struct Tiles next = tilesMove(tiles, dir, &score);
+		if (tilesEqual(next, tiles)) continue;
+		uint value = 1 + 16 * score + tilesEmpty(next);
+		if (value > bestValue) {
+			best = dir;
+			bestValue = value;
+		}
+	}
+	return best;
+}
+
+static enum Dir tilesCorner(struct Tiles tiles, struct Rng *rng) {
+	(void)rng;
+	static const enum Dir Order[Dirs] = { Down, Left, Right, Up };
+	for (uint i = 0; i < Dirs; ++i) {
+		struct Tiles next = tilesMove(tiles, Order[i], NULL);
+		if (!tilesEqual(next, tiles)) return Order[i];
+	}
+	return Dirs;
+}
+
+static const struct {
+	const char *name;
+	Policy *policy;
+	TilesPolicy *tiles;
+} Policies[] = {
+	{ "random", policyRandom, tilesRandom },
+	{ "greedy", policyGreedy, tilesGreedy },
+	{ "corner", policyCorner, tilesCorner },
+};
+
+static struct {
+	Policy *policy;
+	TilesPolicy *tilesPolicy;
+	uint n;
+	uint64_t seed;
+	uint games;
+	atomic_uint next;
+	uint *scores;
+	uint *lengths;
+	atomic_uint_least64_t tiles[16];
+} sim;
+
+// Each plays out a game and returns its largest tile.
+static uint playGrid(struct Rng *rng, uint *score, uint *moves) {
+	Grid grid = gridSpawn(gridSpawn(0, rng), rng);
+	while (!gridOver(grid)) {
+		enum Dir dir = sim.policy(grid, rng);
+		grid = gridSpawn(gridMove(grid, dir, score), rng);
+		++*moves;
+	}
+	uint max = 0;
+	for (; grid; grid >>= 4) {
+		if ((grid & 0xF) > max) max = grid & 0xF;
+	}
+	return max;
+}
+
+static uint playTiles(struct Rng *rng, uint *score, uint *moves) {
+	struct Tiles tiles = { .n = sim.n };
+	tiles = tilesSpawn(tilesSpawn(tiles, rng), rng);
+	while (!tilesOver(tiles)) {
+		enum Dir dir = sim.tilesPolicy(tiles, rng);
+		tiles = tilesSpawn(tilesMove(tiles, dir, score), rng);
+		++*moves;
+	}
+	uint max = 0;
+	for (uint y = 0; y < tiles.n; ++y) {
+		for (uint x = 0; x < tiles.n; ++x) {
+			if (tilesTile(&tiles, y, x) > max) max = tilesTile(&tiles, y, x);
+		}
+	}
+	return max;
+}
+
+static void play(uint game, uint64_t tiles[static 16]) {
+	struct Rng rng;
+	rngSeed(&rng, sim.seed + game);
+	uint score = 0, moves = 0;
+	uint max = (sim.n == 4 ? playGrid : playTiles)(&rng, &score, &moves);
+	tiles[max]++;
+	sim.scores[game] = score;
+	sim.lengths[game] = moves;
+}
+
+enum { Batch = 256 };
+
+static void *work(void *ptr) {
+	(void)ptr;
+	uint64_t tiles[16] = {0};
+	for (uint base; (base = atomic_fetch_add(&sim.next, Batch)) < sim.games;) {
+		uint end = (sim.games - base < Batch ? sim.games : base + Batch);
+		for (uint game = base; game < end; ++game) {
+			play(game, tiles);
+		}
+	}
+	for (uint i = 0; i < 16; ++i) {
+		sim.tiles[i] += tiles[i];
+	}
+	return NULL;
+}
+
+static int compare(const void *_a, const void *_b) {
+	const uint *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+static void distribution(const char *name, uint *values, uint64_t *sum) {
+	*sum = 0;
+	for (uint i = 0; i < sim.games; ++i) {
+		*sum += values[i];
+	}
+	qsort(values, sim.games, sizeof(*values), compare);
+	printf(
+		"%s mean %.1f min %u p10 %u p50 %u p90 %u p99 %u max %u\n",
+		name, (double)*sum / sim.games, values[0],
+		values[sim.games / 10], values[sim.games / 2],
+		values[sim.games * 9ULL / 10], values[sim.games * 99ULL / 100],
+		values[sim.games - 1]
+	);
+}
+
+struct Baseline {
+	char policy[16];
+	uint64_t seed;
+	uint games;
+	uint64_t moves;
+	uint64_t score;
+	double rate;
+	uint n;
+};
+
+// Baselines from before sizes end at rate, and are for 4x4.
+static const char *BaselineFormat =
+	"policy %15s\nseed %" SCNu64 "\ngames %u\n"
+	"moves %" SCNu64 "\nscore %" SCNu64 "\nrate %lf\nsize %u\n";
+
+// Fraction of the baseline rate a run may lose before it is a regression.
+static const double Tolerance = 0.1;
+
+int main(int argc, char *argv[]) {
+	const char *policy = "corner";
+	const char *baseline = NULL;
+	bool write = false;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	sim.n = 4;
+	sim.seed = 1;
+	sim.games = 100000;
+	for (int opt; 0 < (opt = getopt(argc, argv, "b:g:j:n:p:s:w"));) {
+		switch (opt) {
+			break; case 'b': baseline = optarg;
+			break; case 'g': sim.games = strtoul(optarg, NULL, 10);
+			break; case 'j': threads = strtol(optarg, NULL, 10);
+			break; case 'n': sim.n = strtoul(optarg, NULL, 10);
+			break; case 'p': policy = optarg;
+			break; case 's': sim.seed = strtoull(optarg, NULL, 10);
+			break; case 'w': write = true;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (!sim.games) errx(EX_USAGE, "no games");
+	if (sim.n < 3 || sim.n > TilesMax) {
+		errx(EX_USAGE, "size must be 3 to %u", (uint)TilesMax);
+	}
+	if (write && !baseline) errx(EX_USAGE, "-w needs a baseline from -b");
+	if (threads < 1) threads = 1;
+	for (uint i = 0; i < ARRAY_LEN(Policies); ++i) {
+		if (strcmp(Policies[i].name, policy)) continue;
+		sim.policy = Policies[i].policy;
+		sim.tilesPolicy = Policies[i].tiles;
+	}
+	if (!sim.policy) errx(EX_USAGE, "unknown policy %s", policy);
+
+	sim.scores = calloc(sim.games, sizeof(*sim.scores));
+	sim.lengths = calloc(sim.games, sizeof(*sim.lengths));
+	if (!sim.scores || !sim.lengths) err(EX_OSERR, "calloc");
+	pthread_t *thread = calloc(threads, sizeof(*thread));
+	if (!thread) err(EX_OSERR, "calloc");
+
+	gridInit();
+	tilesInit();
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < threads; ++i) {
+		int error = pthread_create(&thread[i], NULL, work, NULL);
+		if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+	}
+	for (long i = 0; i < threads; ++i) {
+		pthread_join(thread[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec)
+		+ (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	struct Baseline run = { .seed = sim.seed, .games = sim.games, .n = sim.n };
+	snprintf(run.policy, sizeof(run.policy), "%s", policy);
+	printf(
+		"policy %s size %u seed %" PRIu64 " games %u threads %ld\n",
+		policy, sim.n, sim.seed, sim.games, threads
+	);
+	distribution("score", sim.scores, &run.score);
+	distribution("moves", sim.lengths, &run.moves);
+	run.rate = run.moves / elapsed;
+	printf("elapsed %.3f moves/s %.0f\n", elapsed, run.rate);
+	for (uint i = 0; i < 16; ++i) {
+		if (!sim.tiles[i]) continue;
+		printf(
+			"tile %u games %" PRIu64 " %.2f%%\n",
+			1U << i, (uint64_t)sim.tiles[i],
+			100.0 * sim.tiles[i] / sim.games
+		);
+	}
+
+	if (!baseline) return EX_OK;
+	if (write) {
+		FILE *file = fopen(baseline, "w");
+		if (!file) err(EX_CANTCREAT, "%s", baseline);
+		fprintf(
+			file, "policy %s\nseed %" PRIu64 "\ngames %u\n"
+			"moves %" PRIu64 "\nscore %" PRIu64 "\nrate %.0f\nsize %u\n",
+			run.policy, run.seed, run.games, run.moves, run.score, run.rate,
+			run.n
+		);
+		if (fclose(file)) err(EX_IOERR, "%s", baseline);
+		return EX_OK;
+	}
+
+	FILE *file = fopen(baseline, "r");
+	if (!file) err(EX_NOINPUT, "%s", baseline);
+	struct Baseline base = { .n = 4 };
+	int n = fscanf(
+		file, BaselineFormat, base.policy, &base.seed, &base.games,
+		&base.moves, &base.score, &base.rate, &base.n
+	);
+	if (n != 6 && n != 7) errx(EX_DATAERR, "%s: invalid baseline", baseline);
+	fclose(file);
+
+	int status = EX_OK;
+	if (
+		strcmp(base.policy, run.policy) || base.n != run.n ||
+		base.seed != run.seed || base.games != run.games
+	) {
+		errx(EX_USAGE, "%s: baseline is for a different run", baseline);
+	}
+	if (base.moves != run.moves || base.score != run.score) {
+		warnx(
+			"games diverge from baseline: moves %" PRIu64 " score %" PRIu64,
+			base.moves, base.score
+		);
+		status = EXIT_FAILURE;
+	}
+	if (run.rate < base.rate * (1 - Tolerance)) {
+		warnx(
+			"moves/s regressed %.1f%% from baseline %.0f",
+			100 * (1 - run.rate / base.rate), base.rate
+		);
+		status = EXIT_FAILURE;
+	}
+	return status;
+}
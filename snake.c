@@ -18,119 +18,159 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 
-#include <utils/arc4random.h>
-
-typedef unsigned uint;
-typedef unsigned char byte;
+#include "play.h"
 
 enum {
-	Rows = 24,
-	Cols = 48,
+	Rows = WormRows,
+	Cols = WormCols,
+	TickDelay = 150,
+	KeysCap = 16,
 };
 
-static uint score;
-static const char *over;
+// Keys wait here so that each tick takes at most one, as when the game
+// read a single key between ticks.
+struct State {
+	struct Worm worm;
+	bool paused;
+	uint keysLen;
+	int keys[KeysCap];
+};
 
-static struct {
-	uint len;
-	byte y[Rows * Cols];
-	byte x[Rows * Cols];
-} snake = { .len = 1 };
+static const char *Overs[] = {
+	NULL,
+	"You eated the wall D:",
+	"You eated yourself :(",
+	"You ate spoiled food!",
+	"You are satisfied.",
+};
 
-static struct {
-	int y, x;
-	int dy, dx;
-} head = { Rows / 2, Cols / 2, 0, 1 };
+static void init(void *ptr, struct Rng *rng) {
+	(void)rng;
+	struct State *state = ptr;
+	*state = (struct State) {0};
+	wormInit(&state->worm);
+}
 
-enum {
-	FoodCap = 25,
-	FoodChance = 15,
-	FoodRipe = Rows + Cols,
-	FoodSpoil = FoodRipe + Cols,
-	FoodMulch = FoodSpoil * 10,
-};
+static void input(struct State *state, int ch) {
+	struct Worm *worm = &state->worm;
+	int dy = worm->head.dy;
+	int dx = worm->head.dx;
+	switch (ch) {
+		break; case 'h': case KEY_LEFT:  dy =  0; dx = -1;
+		break; case 'j': case KEY_DOWN:  dy = +1; dx =  0;
+		break; case 'k': case KEY_UP:    dy = -1; dx =  0;
+		break; case 'l': case KEY_RIGHT: dy =  0; dx = +1;
+		break; case 'q': worm->over = Overs[4];
+		break; case 'p': case ' ': state->paused = true;
+	}
+	wormTurn(worm, dy, dx);
+}
 
-static struct {
-	uint len;
-	byte y[FoodCap];
-	byte x[FoodCap];
-	uint age[FoodCap];
-} food;
-
-static void tick(void) {
-	for (uint i = 0; i < food.len; ++i) {
-		if (head.y + head.dy != food.y[i]) continue;
-		if (head.x + head.dx != food.x[i]) continue;
-		if (food.age[i] > FoodSpoil) {
-			over = "You ate spoiled food!";
-			return;
-		}
-		score += snake.len * (food.age[i] > FoodRipe ? 2 : 1);
-		food.len--;
-		food.y[i] = food.y[food.len];
-		food.x[i] = food.x[food.len];
-		food.age[i] = food.age[food.len];
-		snake.len++;
-		break;
+static uint step(void *ptr, int key, struct Rng *rng) {
+	struct State *state = ptr;
+	struct Worm *worm = &state->worm;
+	if (worm->over) {
+		if (
+			key == KEY_LEFT || key == KEY_DOWN ||
+			key == KEY_UP || key == KEY_RIGHT
+		) return 0;
+		return EventDone;
 	}
-	for (uint i = food.len - 1; i < food.len; --i) {
-		if (food.age[i]++ < FoodMulch) continue;
-		food.len--;
-		food.y[i] = food.y[food.len];
-		food.x[i] = food.x[food.len];
-		food.age[i] = food.age[food.len];
+	if (state->paused) {
+		if (key == 'p' || key == ' ') state->paused = false;
+		return 0;
 	}
-	if (!food.len || (food.len < FoodCap && !arc4random_uniform(FoodChance))) {
-		int y = arc4random_uniform(Rows);
-		int x = arc4random_uniform(Cols);
-		bool empty = true;
-		if (y == head.y && x == head.x) empty = false;
-		for (uint i = 0; i < snake.len; ++i) {
-			if (y == snake.y[i] && x == snake.x[i]) empty = false;
-		}
-		for (uint i = 0; i < food.len; ++i) {
-			if (y == food.y[i] && x == food.x[i]) empty = false;
-		}
-		if (empty) {
-			food.y[food.len] = y;
-			food.x[food.len] = x;
-			food.age[food.len] = 0;
-			food.len++;
-		}
+	if (key != Tick) {
+		if (state->keysLen < KeysCap) state->keys[state->keysLen++] = key;
+		return 0;
 	}
-	for (uint i = snake.len - 1; i < snake.len; --i) {
-		if (i) {
-			snake.y[i] = snake.y[i-1];
-			snake.x[i] = snake.x[i-1];
-		} else {
-			snake.y[i] = head.y;
-			snake.x[i] = head.x;
-		}
+	if (state->keysLen) {
+		input(state, state->keys[0]);
+		memmove(
+			&state->keys[0], &state->keys[1],
+			sizeof(state->keys[0]) * --state->keysLen
+		);
+		if (state->paused) return 0;
 	}
-	head.y += head.dy;
-	head.x += head.dx;
-	if (head.y < 0 || head.x < 0 || head.y >= Rows || head.x >= Cols) {
-		over = "You eated the wall D:";
+	if (!worm->over) wormTick(worm, rng);
+	return DirtyAll | (worm->over ? EventOver : 0);
+}
+
+static int delay(const void *ptr) {
+	const struct State *state = ptr;
+	return (state->paused || state->worm.over ? Forever : TickDelay);
+}
+
+static uint score(const void *ptr) {
+	const struct State *state = ptr;
+	return state->worm.score;
+}
+
+static size_t save(const void *ptr, byte *buf, size_t cap) {
+	const struct State *state = ptr;
+	struct Worm worm = state->worm;
+	byte over = 0;
+	for (uint i = 1; i < ARRAY_LEN(Overs); ++i) {
+		if (worm.over && !strcmp(worm.over, Overs[i])) over = i;
+	}
+	worm.over = NULL;
+	byte data[sizeof(worm) + 1];
+	memcpy(data, &worm, sizeof(worm));
+	data[sizeof(worm)] = over;
+	return saveCopy(buf, cap, data, sizeof(data));
+}
+
+// Saves come from disk, so everything the tick and render index by is
+// checked, and the bits are rebuilt to check they match the segments.
+static bool intact(const struct Worm *worm) {
+	if (!worm->body.len || worm->body.len >= WormCap) return false;
+	if (worm->body.first >= WormCap || worm->food.len > FoodCap) return false;
+	uint64_t bits[Rows] = {0};
+	for (uint i = 0; i < worm->body.len; ++i) {
+		uint j = wormSegment(worm, i);
+		int y = worm->body.y[j], x = worm->body.x[j];
+		if (y >= Rows || x >= Cols || bits[y] >> x & 1) return false;
+		bits[y] |= 1ULL << x;
 	}
-	for (uint i = 0; i < snake.len; ++i) {
-		if (head.y != snake.y[i] || head.x != snake.x[i]) continue;
-		over = "You eated yourself :(";
+	if (memcmp(bits, worm->body.bits, sizeof(bits))) return false;
+	memset(bits, 0, sizeof(bits));
+	for (uint i = 0; i < worm->food.len; ++i) {
+		int y = worm->food.y[i], x = worm->food.x[i];
+		if (y >= Rows || x >= Cols || bits[y] >> x & 1) return false;
+		bits[y] |= 1ULL << x;
 	}
+	if (memcmp(bits, worm->food.bits, sizeof(bits))) return false;
+	int dy = worm->head.dy, dx = worm->head.dx;
+	if (dy < -1 || dy > +1 || dx < -1 || dx > +1 || !dy == !dx) return false;
+	int y = worm->head.y, x = worm->head.x;
+	if (worm->over) {
+		// The head is left wherever it ended, maybe in the wall.
+		return y >= -1 && x >= -1 && y <= Rows && x <= Cols;
+	}
+	return y >= 0 && x >= 0 && y < Rows && x < Cols
+		&& !(worm->body.bits[y] >> x & 1);
+}
+
+static bool load(void *ptr, const byte *buf, size_t len) {
+	struct State *state = ptr;
+	if (len != sizeof(state->worm) + 1) return false;
+	if (buf[len - 1] >= ARRAY_LEN(Overs)) return false;
+	struct Worm worm;
+	memcpy(&worm, buf, sizeof(worm));
+	worm.over = Overs[buf[len - 1]];
+	if (!intact(&worm)) return false;
+	state->worm = worm;
+	state->paused = false;
+	state->keysLen = 0;
+	return true;
 }
 
-enum { KeyOK = KEY_MAX + 1 };
 static void curse(void) {
-	initscr();
-	cbreak();
 	noecho();
 	curs_set(0);
 	keypad(stdscr, true);
-	nodelay(stdscr, true);
-	define_key("\33[0n", KeyOK);
-	start_color();
-	use_default_colors();
 	init_pair(1, COLOR_GREEN, -1);
 	init_pair(2, COLOR_YELLOW, -1);
 	init_pair(3, COLOR_RED, -1);
@@ -139,86 +179,53 @@ static void curse(void) {
 	mvaddch(Rows, Cols, ACS_LRCORNER);
 }
 
-static void draw(void) {
+static void render(const void *ptr, uint dirty) {
+	const struct State *state = ptr;
+	const struct Worm *worm = &state->worm;
+	if (!dirty) return;
 	char buf[16];
-	snprintf(buf, sizeof(buf), "%u", score);
+	snprintf(buf, sizeof(buf), "%u", worm->score);
 	mvaddstr(0, Cols + 2, buf);
-	if (over) {
-		mvaddstr(2, Cols + 2, over);
+	if (worm->over) {
+		mvaddstr(2, Cols + 2, worm->over);
 		mvaddstr(3, Cols + 2, "Press any key to");
 		mvaddstr(4, Cols + 2, "view the scoreboard.");
 	}
 	for (int y = 0; y < Rows; ++y) {
 		mvhline(y, 0, ' ', Cols);
 	}
-	for (uint i = 0; i < food.len; ++i) {
-		if (food.age[i] > FoodSpoil) {
-			mvaddch(food.y[i], food.x[i], '*' | COLOR_PAIR(3));
-		} else if (food.age[i] > FoodRipe) {
-			mvaddch(food.y[i], food.x[i], '%' | COLOR_PAIR(2));
+	for (uint i = 0; i < worm->food.len; ++i) {
+		int y = worm->food.y[i], x = worm->food.x[i];
+		if (worm->food.age[i] > FoodSpoil) {
+			mvaddch(y, x, '*' | COLOR_PAIR(3));
+		} else if (worm->food.age[i] > FoodRipe) {
+			mvaddch(y, x, '%' | COLOR_PAIR(2));
 		} else {
-			mvaddch(food.y[i], food.x[i], '&' | COLOR_PAIR(1));
+			mvaddch(y, x, '&' | COLOR_PAIR(1));
 		}
 	}
-	for (uint i = 0; i < snake.len; ++i) {
-		if (i + 1 < snake.len) {
-			mvaddch(snake.y[i], snake.x[i], '#' | COLOR_PAIR(2));
+	for (uint i = 0; i < worm->body.len; ++i) {
+		uint j = wormSegment(worm, i);
+		int y = worm->body.y[j], x = worm->body.x[j];
+		if (i + 1 < worm->body.len) {
+			mvaddch(y, x, '#' | COLOR_PAIR(2));
 		} else {
-			mvaddch(snake.y[i], snake.x[i], '*' | COLOR_PAIR(2));
+			mvaddch(y, x, '*' | COLOR_PAIR(2));
 		}
 	}
-	mvaddch(head.y, head.x, '@' | A_BOLD);
-	move(head.y, head.x);
-	refresh();
+	mvaddch(worm->head.y, worm->head.x, '@' | A_BOLD);
+	move(worm->head.y, worm->head.x);
 }
 
-static void input(void) {
-	int ch = getch();
-	if (ch == ERR) {
-		putp("\33[5n");
-		fflush(stdout);
-		nodelay(stdscr, false);
-		ch = getch();
-		nodelay(stdscr, true);
-	}
-	int dy = head.dy;
-	int dx = head.dx;
-	switch (ch) {
-		break; case 'h': case KEY_LEFT:  dy =  0; dx = -1;
-		break; case 'j': case KEY_DOWN:  dy = +1; dx =  0;
-		break; case 'k': case KEY_UP:    dy = -1; dx =  0;
-		break; case 'l': case KEY_RIGHT: dy =  0; dx = +1;
-		break; case 'q': over = "You are satisfied.";
-		break; case 'p': case ' ': {
-			nodelay(stdscr, false);
-			do {
-				ch = getch();
-			} while (ch != ERR && ch != 'p' && ch != ' ');
-			nodelay(stdscr, true);
-		}
-		break; case ERR: exit(EXIT_FAILURE);
-	}
-	if (dy == -head.dy && dx == -head.dx) return;
-	head.dy = dy;
-	head.dx = dx;
-}
-
-uint playSnake(void) {
-	curse();
-	do {
-		tick();
-		draw();
-		usleep(150000);
-		input();
-	} while (!over);
-	draw();
-	while (ERR != getch());
-	nodelay(stdscr, false);
-	int ch;
-	do {
-		ch = getch();
-	} while (
-		ch == KEY_LEFT || ch == KEY_DOWN || ch == KEY_UP || ch == KEY_RIGHT
-	);
-	return score;
-}
+const struct Engine EngineSnake = {
+	.size = sizeof(struct State),
+	.sync = true,
+	.curse = curse,
+	.init = init,
+	.step = step,
+	.delay = delay,
+	.render = render,
+	.score = score,
+	.save = save,
+	.load = load,
+};
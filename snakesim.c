@@ -0,0 +1,461 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+enum {
+	Rows = WormRows,
+	Cols = WormCols,
+};
+
+static const int DY[4] = {  0, +1, -1,  0 };
+static const int DX[4] = { -1,  0,  0, +1 };
+
+static bool safe(const struct Worm *worm, int y, int x) {
+	if (y < 0 || x < 0 || y >= Rows || x >= Cols) return false;
+	if (worm->body.bits[y] >> x & 1) return false;
+	if (!(worm->food.bits[y] >> x & 1)) return true;
+	for (uint i = 0; i < worm->food.len; ++i) {
+		if (worm->food.y[i] != y || worm->food.x[i] != x) continue;
+		return worm->food.age[i] <= FoodSpoil;
+	}
+	return true;
+}
+
+static bool reverse(const struct Worm *worm, uint dir) {
+	return DY[dir] == -worm->head.dy && DX[dir] == -worm->head.dx;
+}
+
+typedef void Bot(struct Worm *worm, struct Rng *rng);
+
+// Goes straight, turning at random now and then or to avoid death.
+static void botRandom(struct Worm *worm, struct Rng *rng) {
+	int y = worm->head.y + worm->head.dy;
+	int x = worm->head.x + worm->head.dx;
+	if (safe(worm, y, x) && rngUniform(rng, 8)) return;
+	uint dirs[4], len = 0;
+	for (uint dir = 0; dir < 4; ++dir) {
+		if (reverse(worm, dir)) continue;
+		if (!safe(worm, worm->head.y + DY[dir], worm->head.x + DX[dir])) {
+			continue;
+		}
+		dirs[len++] = dir;
+	}
+	if (!len) return;
+	uint dir = dirs[rngUniform(rng, len)];
+	wormTurn(worm, DY[dir], DX[dir]);
+}
+
+static uint distance(int y1, int x1, int y2, int x2) {
+	return abs(y1 - y2) + abs(x1 - x2);
+}
+
+// Heads for the nearest edible food by Manhattan distance.
+static void botGreedy(struct Worm *worm, struct Rng *rng) {
+	(void)rng;
+	int hy = worm->head.y, hx = worm->head.x;
+	int fy = -1, fx = -1;
+	uint min = -1;
+	for (uint i = 0; i < worm->food.len; ++i) {
+		if (worm->food.age[i] > FoodSpoil) continue;
+		uint d = distance(hy, hx, worm->food.y[i], worm->food.x[i]);
+		if (d >= min) continue;
+		min = d;
+		fy = worm->food.y[i];
+		fx = worm->food.x[i];
+	}
+	uint best = 4;
+	min = -1;
+	for (uint dir = 0; dir < 4; ++dir) {
+		int y = hy + DY[dir], x = hx + DX[dir];
+		if (reverse(worm, dir) || !safe(worm, y, x)) continue;
+		uint d = (fy < 0 ? 0 : distance(y, x, fy, fx));
+		bool straight = (DY[dir] == worm->head.dy && DX[dir] == worm->head.dx);
+		if (d < min || (d == min && straight)) {
+			best = dir;
+			min = d;
+		}
+	}
+	if (best < 4) wormTurn(worm, DY[best], DX[best]);
+}
+
+// Follows a Hamiltonian cycle. Moving only forwards in cycle order through
+// the free cells between the head and the tail keeps the body in cycle
+// order, so the tail always clears the way, and a shortcut never skips
+// over any of the body. While the worm is short it takes the fewest steps
+// to the first food it can eat fresh, keeping Margin cells of the way
+// ahead; past Long it only follows the cycle, stepping around food that
+// would be spoiled by the time it got there.
+static uint order[Rows][Cols];
+static struct {
+	byte y, x;
+} cell[WormCap];
+
+static void visit(uint *n, int y, int x) {
+	order[y][x] = *n;
+	cell[*n].y = y;
+	cell[*n].x = x;
+	++*n;
+}
+
+// Wiggles through two rows at a time, a column at a time, which keeps
+// every cell a short hop from the cells after it. The left 23 columns are
+// swept down, and the right 25 back up.
+static void band(uint *n, int y, int from, int to, bool up) {
+	int dx = (to < from ? -1 : +1);
+	for (int x = from; x != to + dx; x += dx, up = !up) {
+		visit(n, y + up, x);
+		visit(n, y + !up, x);
+	}
+}
+
+static void cycleInit(void) {
+	uint n = 0;
+	int mid = Cols / 2 - 1;
+	for (int y = 0; y < Rows; y += 2) {
+		if (y / 2 & 1) {
+			band(&n, y, 0, mid - 1, false);
+		} else {
+			band(&n, y, mid - 1, 0, false);
+		}
+	}
+	for (int y = Rows - 2; y >= 0; y -= 2) {
+		if (y / 2 & 1) {
+			band(&n, y, mid, Cols - 1, true);
+		} else {
+			band(&n, y, Cols - 1, mid, true);
+		}
+	}
+}
+
+static uint ahead(uint from, uint to) {
+	return (to + WormCap - from) % WormCap;
+}
+
+static int foodAge(const struct Worm *worm, int y, int x) {
+	if (!(worm->food.bits[y] >> x & 1)) return -1;
+	for (uint i = 0; i < worm->food.len; ++i) {
+		if (worm->food.y[i] == y && worm->food.x[i] == x) {
+			return worm->food.age[i];
+		}
+	}
+	return -1;
+}
+
+// Returns the offset ahead of the head of the cell next to offset i, or 0
+// off the board.
+static uint neighbor(uint head, uint i, uint dir) {
+	int y = cell[(head + i) % WormCap].y + DY[dir];
+	int x = cell[(head + i) % WormCap].x + DX[dir];
+	if (y < 0 || x < 0 || y >= Rows || x >= Cols) return 0;
+	return ahead(head, order[y][x]);
+}
+
+enum {
+	Margin = 64,
+	Long = 300,
+};
+
+static void botCycle(struct Worm *worm, struct Rng *rng) {
+	(void)rng;
+	uint head = order[worm->head.y][worm->head.x];
+	uint tail = wormSegment(worm, worm->body.len - 1);
+	uint room = ahead(head, order[worm->body.y[tail]][worm->body.x[tail]]);
+
+	// Marks the offsets from which the tail can be reached, passing no food
+	// that could have spoiled by the time the head got there.
+	bool reach[WormCap], out[WormCap];
+	out[room] = true;
+	for (uint i = room - 1; i > 0; --i) {
+		reach[i] = false;
+		for (uint dir = 0; dir < 4 && !reach[i]; ++dir) {
+			uint j = neighbor(head, i, dir);
+			reach[i] = (j > i && j <= room && out[j]);
+		}
+		int y = cell[(head + i) % WormCap].y;
+		int x = cell[(head + i) % WormCap].x;
+		int age = foodAge(worm, y, x);
+		out[i] = reach[i] && !(worm->body.bits[y] >> x & 1);
+		if (age >= 0 && age + i > FoodSpoil) out[i] = false;
+	}
+
+	// While short, takes the fewest steps to the nearest food it can eat
+	// fresh and still get out from.
+	uint16_t steps[WormCap];
+	byte first[WormCap];
+	uint goal = 0;
+	for (uint i = 1; i <= room; ++i) {
+		steps[i] = UINT16_MAX;
+	}
+	steps[0] = 0;
+	for (uint i = 0; i < room && worm->body.len < Long; ++i) {
+		if (steps[i] == UINT16_MAX) continue;
+		int age = foodAge(
+			worm, cell[(head + i) % WormCap].y, cell[(head + i) % WormCap].x
+		);
+		if (i && age >= 0 && age + steps[i] <= FoodSpoil) {
+			goal = i;
+			break;
+		}
+		if (i && !out[i]) continue;
+		for (uint dir = 0; dir < 4; ++dir) {
+			uint j = neighbor(head, i, dir);
+			if (j <= i || j >= room || steps[i] + 1 >= steps[j]) continue;
+			if (j > i + 1 && j + Margin > room + steps[i]) continue;
+			if (!reach[j]) continue;
+			steps[j] = steps[i] + 1;
+			first[j] = (i ? first[i] : dir);
+		}
+	}
+
+	// Otherwise follows the cycle, stepping around spoiled food.
+	if (!goal) {
+		for (uint dir = 0; dir < 4; ++dir) {
+			uint j = neighbor(head, 0, dir);
+			if (!j || j > room || !out[j] || (goal && j >= goal)) continue;
+			goal = j;
+			first[j] = dir;
+		}
+	}
+	if (!goal) {
+		// Cornered: anything that lives another tick.
+		for (uint dir = 0; dir < 4; ++dir) {
+			uint j = neighbor(head, 0, dir);
+			if (!j) continue;
+			int y = cell[(head + j) % WormCap].y;
+			int x = cell[(head + j) % WormCap].x;
+			if (worm->body.bits[y] >> x & 1) continue;
+			if (foodAge(worm, y, x) >= FoodSpoil) continue;
+			goal = j;
+			first[j] = dir;
+		}
+	}
+	if (goal) wormTurn(worm, DY[first[goal]], DX[first[goal]]);
+}
+
+static const struct {
+	const char *name;
+	Bot *bot;
+} Bots[] = {
+	{ "random", botRandom },
+	{ "greedy", botGreedy },
+	{ "cycle", botCycle },
+};
+
+enum {
+	Buckets = 9,
+	BucketLen = WormCap / (Buckets - 1),
+	Sample = 16,
+};
+
+static const char *Ends[] = {
+	"You eated the wall D:",
+	"You eated yourself :(",
+	"You ate spoiled food!",
+	NULL,
+};
+
+struct Stats {
+	uint64_t ticks;
+	uint64_t ends[ARRAY_LEN(Ends)];
+	uint64_t placed, fresh, ripe, mulched;
+	uint64_t bucketTicks[Buckets];
+	uint64_t bucketNanos[Buckets];
+};
+
+static struct {
+	Bot *bot;
+	uint64_t seed;
+	uint games;
+	uint limit;
+	atomic_uint next;
+	uint *scores;
+	uint *lengths;
+	uint *ticks;
+	pthread_mutex_t mutex;
+	struct Stats stats;
+} sim = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t nanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void play(uint game, struct Stats *stats) {
+	struct Worm worm;
+	struct Rng rng;
+	wormInit(&worm);
+	rngSeed(&rng, sim.seed + game);
+	uint tick;
+	for (tick = 0; !worm.over && tick < sim.limit; ++tick) {
+		sim.bot(&worm, &rng);
+		if (tick % Sample) {
+			wormTick(&worm, &rng);
+			continue;
+		}
+		uint bucket = worm.body.len / BucketLen;
+		uint64_t start = nanos();
+		wormTick(&worm, &rng);
+		stats->bucketNanos[bucket] += nanos() - start;
+		stats->bucketTicks[bucket]++;
+	}
+	uint end = 0;
+	while (Ends[end] && (!worm.over || strcmp(Ends[end], worm.over))) {
+		end++;
+	}
+	stats->ends[end]++;
+	stats->ticks += tick;
+	stats->placed += worm.stats.placed;
+	stats->fresh += worm.stats.fresh;
+	stats->ripe += worm.stats.ripe;
+	stats->mulched += worm.stats.mulched;
+	sim.scores[game] = worm.score;
+	sim.lengths[game] = worm.body.len;
+	sim.ticks[game] = tick;
+}
+
+enum { Batch = 16 };
+
+static void *work(void *ptr) {
+	(void)ptr;
+	struct Stats stats = {0};
+	for (uint base; (base = atomic_fetch_add(&sim.next, Batch)) < sim.games;) {
+		uint end = (sim.games - base < Batch ? sim.games : base + Batch);
+		for (uint game = base; game < end; ++game) {
+			play(game, &stats);
+		}
+	}
+	pthread_mutex_lock(&sim.mutex);
+	uint64_t *dst = (uint64_t *)&sim.stats;
+	const uint64_t *src = (const uint64_t *)&stats;
+	for (size_t i = 0; i < sizeof(stats) / sizeof(*src); ++i) {
+		dst[i] += src[i];
+	}
+	pthread_mutex_unlock(&sim.mutex);
+	return NULL;
+}
+
+static int compare(const void *_a, const void *_b) {
+	const uint *a = _a, *b = _b;
+	return (*a > *b) - (*a < *b);
+}
+
+static void distribution(const char *name, uint *values) {
+	uint64_t sum = 0;
+	for (uint i = 0; i < sim.games; ++i) {
+		sum += values[i];
+	}
+	qsort(values, sim.games, sizeof(*values), compare);
+	printf(
+		"%s mean %.1f min %u p10 %u p50 %u p90 %u p99 %u max %u\n",
+		name, (double)sum / sim.games, values[0],
+		values[sim.games / 10], values[sim.games / 2],
+		values[sim.games * 9ULL / 10], values[sim.games * 99ULL / 100],
+		values[sim.games - 1]
+	);
+}
+
+int main(int argc, char *argv[]) {
+	const char *bot = "cycle";
+	uint least = 0;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	sim.seed = 1;
+	sim.games = 1000;
+	sim.limit = 100000;
+	for (int opt; 0 < (opt = getopt(argc, argv, "b:g:j:l:s:t:"));) {
+		switch (opt) {
+			break; case 'b': bot = optarg;
+			break; case 'g': sim.games = strtoul(optarg, NULL, 10);
+			break; case 'j': threads = strtol(optarg, NULL, 10);
+			break; case 'l': least = strtoul(optarg, NULL, 10);
+			break; case 's': sim.seed = strtoull(optarg, NULL, 10);
+			break; case 't': sim.limit = strtoul(optarg, NULL, 10);
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (!sim.games) errx(EX_USAGE, "no games");
+	if (threads < 1) threads = 1;
+	for (uint i = 0; i < ARRAY_LEN(Bots); ++i) {
+		if (!strcmp(Bots[i].name, bot)) sim.bot = Bots[i].bot;
+	}
+	if (!sim.bot) errx(EX_USAGE, "unknown bot %s", bot);
+
+	sim.scores = calloc(sim.games, sizeof(*sim.scores));
+	sim.lengths = calloc(sim.games, sizeof(*sim.lengths));
+	sim.ticks = calloc(sim.games, sizeof(*sim.ticks));
+	if (!sim.scores || !sim.lengths || !sim.ticks) err(EX_OSERR, "calloc");
+	pthread_t *thread = calloc(threads, sizeof(*thread));
+	if (!thread) err(EX_OSERR, "calloc");
+
+	cycleInit();
+	uint64_t start = nanos();
+	for (long i = 0; i < threads; ++i) {
+		int error = pthread_create(&thread[i], NULL, work, NULL);
+		if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+	}
+	for (long i = 0; i < threads; ++i) {
+		pthread_join(thread[i], NULL);
+	}
+	double elapsed = (nanos() - start) / 1e9;
+
+	const struct Stats *stats = &sim.stats;
+	printf(
+		"bot %s seed %" PRIu64 " games %u threads %ld\n",
+		bot, sim.seed, sim.games, threads
+	);
+	distribution("score", sim.scores);
+	distribution("length", sim.lengths);
+	distribution("ticks", sim.ticks);
+	printf(
+		"elapsed %.3f ticks/s %.0f\n", elapsed, stats->ticks / elapsed
+	);
+	for (uint i = 0; i < Buckets; ++i) {
+		if (!stats->bucketTicks[i]) continue;
+		printf(
+			"length %4u-%-4u sampled %" PRIu64 " ns/tick %.1f\n",
+			i * BucketLen, (i + 1) * BucketLen - 1, stats->bucketTicks[i],
+			(double)stats->bucketNanos[i] / stats->bucketTicks[i]
+		);
+	}
+	printf(
+		"food placed %" PRIu64 " fresh %" PRIu64 " ripe %" PRIu64
+		" spoiled %" PRIu64 " mulched %" PRIu64 "\n",
+		stats->placed, stats->fresh, stats->ripe, stats->ends[2],
+		stats->mulched
+	);
+	for (uint i = 0; i < ARRAY_LEN(Ends); ++i) {
+		printf(
+			"end %s %" PRIu64 "\n",
+			(Ends[i] ? Ends[i] : "(tick limit)"), stats->ends[i]
+		);
+	}
+	for (uint i = 0; i < sim.games; ++i) {
+		if (sim.lengths[i] >= least) continue;
+		errx(EXIT_FAILURE, "a game ended at length %u", sim.lengths[i]);
+	}
+}
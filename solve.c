@@ -0,0 +1,438 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "play.h"
+
+// Best-first search over user moves. Positions keep their real cell and
+// column order so moves map straight back onto the game, but are hashed
+// with the cells and columns sorted, so positions differing only by which
+// cell or empty column a card went to are seen once. Only the 64-bit hash
+// of each seen position is kept.
+
+enum { Cols = 8, Cells = 4 };
+
+struct Pos {
+	byte found[4];
+	Card cells[Cells];
+	byte len[Cols];
+	Card cards[52];
+};
+
+struct Node {
+	struct Pos pos;
+	uint32_t parent;
+	uint16_t depth;
+	byte dst, src, len;
+};
+
+static uint suit(Card card) {
+	return (card & Suit) >> 4;
+}
+
+static bool stacks(Card card, Card onto) {
+	return (card & Color) != (onto & Color)
+		&& (card & Rank) + 1 == (onto & Rank);
+}
+
+static uint colStart(const struct Pos *pos, uint col) {
+	uint start = 0;
+	for (uint i = 0; i < col; ++i) {
+		start += pos->len[i];
+	}
+	return start;
+}
+
+static uint total(const struct Pos *pos) {
+	return colStart(pos, Cols);
+}
+
+static Card colTop(const struct Pos *pos, uint col) {
+	if (!pos->len[col]) return 0;
+	return pos->cards[colStart(pos, col) + pos->len[col] - 1];
+}
+
+static void take(struct Pos *pos, uint src, uint n, Card run[static 13]) {
+	if (src < Tableau) {
+		run[0] = pos->cells[src - Cell];
+		pos->cells[src - Cell] = 0;
+		return;
+	}
+	uint col = src - Tableau;
+	uint end = total(pos);
+	uint start = colStart(pos, col) + pos->len[col] - n;
+	memcpy(run, &pos->cards[start], n);
+	memmove(&pos->cards[start], &pos->cards[start + n], end - start - n);
+	pos->len[col] -= n;
+}
+
+static void give(struct Pos *pos, uint dst, uint n, const Card run[static 13]) {
+	if (dst < Cell) {
+		pos->found[suit(run[0])]++;
+		return;
+	}
+	if (dst < Tableau) {
+		pos->cells[dst - Cell] = run[0];
+		return;
+	}
+	uint col = dst - Tableau;
+	uint end = total(pos);
+	uint start = colStart(pos, col) + pos->len[col];
+	memmove(&pos->cards[start + n], &pos->cards[start], end - start);
+	memcpy(&pos->cards[start], run, n);
+	pos->len[col] += n;
+}
+
+static void apply(struct Pos *pos, uint dst, uint src, uint n) {
+	Card run[13];
+	take(pos, src, n, run);
+	give(pos, dst, n, run);
+}
+
+static bool home(const struct Pos *pos, Card card) {
+	return card && pos->found[suit(card)] + 1 == (card & Rank);
+}
+
+// Same rule as autoEnq() in freecell.c: a card goes home once no card of
+// the other colour in play could still want to be stacked on it.
+static void autoMove(struct Pos *pos) {
+	for (bool moved = true; moved;) {
+		moved = false;
+		Card min[2] = { K, K };
+		for (uint i = 0; i < Cells; ++i) {
+			Card card = pos->cells[i];
+			if (card && (card & Rank) < min[!!(card & Color)]) {
+				min[!!(card & Color)] = card & Rank;
+			}
+		}
+		for (uint i = 0, end = total(pos); i < end; ++i) {
+			Card card = pos->cards[i];
+			if ((card & Rank) < min[!!(card & Color)]) {
+				min[!!(card & Color)] = card & Rank;
+			}
+		}
+		for (uint src = Cell; src < Stacks; ++src) {
+			Card card = (src < Tableau)
+				? pos->cells[src - Cell]
+				: colTop(pos, src - Tableau);
+			if (!home(pos, card)) continue;
+			if (min[!(card & Color)] < (card & Rank) - 1) continue;
+			apply(pos, Foundation, src, 1);
+			moved = true;
+			break;
+		}
+	}
+}
+
+static bool won(const struct Pos *pos) {
+	return pos->found[0] + pos->found[1] + pos->found[2] + pos->found[3]
+		== 52;
+}
+
+static uint64_t mix(uint64_t hash, const byte *ptr, uint len) {
+	for (uint i = 0; i < len; ++i) {
+		hash = (hash ^ ptr[i]) * 0x100000001B3;
+	}
+	return hash;
+}
+
+static uint64_t hash(const struct Pos *pos) {
+	uint64_t hash = mix(0xCBF29CE484222325, pos->found, 4);
+	Card cells[Cells];
+	memcpy(cells, pos->cells, Cells);
+	for (uint i = 1; i < Cells; ++i) {
+		for (uint j = i; j && cells[j - 1] > cells[j]; --j) {
+			Card card = cells[j];
+			cells[j] = cells[j - 1];
+			cells[j - 1] = card;
+		}
+	}
+	hash = mix(hash, cells, Cells);
+	uint start[Cols], order[Cols];
+	for (uint i = 0, s = 0; i < Cols; s += pos->len[i++]) {
+		start[i] = s;
+		order[i] = i;
+	}
+	for (uint i = 1; i < Cols; ++i) {
+		for (uint j = i; j; --j) {
+			uint a = order[j - 1], b = order[j];
+			uint ka = (pos->len[a] ? pos->cards[start[a]] : 0xFF);
+			uint kb = (pos->len[b] ? pos->cards[start[b]] : 0xFF);
+			if (ka <= kb) break;
+			order[j - 1] = b;
+			order[j] = a;
+		}
+	}
+	for (uint i = 0; i < Cols; ++i) {
+		uint col = order[i];
+		hash = mix(hash, &pos->len[col], 1);
+		hash = mix(hash, &pos->cards[start[col]], pos->len[col]);
+	}
+	return (hash ? hash : 1);
+}
+
+// Cards left to go home, occupied cells, cards sitting above a lower card
+// in their column, less a bonus for empty columns.
+static int heuristic(const struct Pos *pos) {
+	int h = 0;
+	for (uint i = 0; i < 4; ++i) {
+		h += 2 * (13 - pos->found[i]);
+	}
+	for (uint i = 0; i < Cells; ++i) {
+		if (pos->cells[i]) h++;
+	}
+	for (uint col = 0, s = 0; col < Cols; s += pos->len[col++]) {
+		if (!pos->len[col]) h -= 2;
+		uint min = K + 1;
+		for (uint i = 0; i < pos->len[col]; ++i) {
+			uint rank = pos->cards[s + i] & Rank;
+			if (rank > min) h += 3;
+			if (rank < min) min = rank;
+		}
+	}
+	return h;
+}
+
+// Longest run on top of a column, as moveDepth() in freecell.c.
+static uint runLen(const struct Pos *pos, uint col) {
+	uint len = pos->len[col];
+	if (len < 2) return len;
+	const Card *cards = &pos->cards[colStart(pos, col)];
+	uint n = 1;
+	while (n < len && stacks(cards[len - n], cards[len - n - 1])) n++;
+	return n;
+}
+
+struct Move {
+	byte dst, src, len;
+};
+
+static uint moves(const struct Pos *pos, struct Move *moves) {
+	uint len = 0;
+	uint free = 0, cell = Stacks;
+	uint spaces = 0, empty = Stacks;
+	for (uint i = 0; i < Cells; ++i) {
+		if (pos->cells[i]) continue;
+		free++;
+		if (cell == Stacks) cell = Cell + i;
+	}
+	for (uint i = 0; i < Cols; ++i) {
+		if (pos->len[i]) continue;
+		spaces++;
+		if (empty == Stacks) empty = Tableau + i;
+	}
+	for (uint src = Cell; src < Tableau; ++src) {
+		Card card = pos->cells[src - Cell];
+		if (!card) continue;
+		if (home(pos, card)) {
+			moves[len++] = (struct Move) { Foundation, src, 1 };
+		}
+		for (uint col = 0; col < Cols; ++col) {
+			Card top = colTop(pos, col);
+			if (top && stacks(card, top)) {
+				moves[len++] = (struct Move) { Tableau + col, src, 1 };
+			}
+		}
+		if (empty < Stacks) moves[len++] = (struct Move) { empty, src, 1 };
+	}
+	for (uint col = 0; col < Cols; ++col) {
+		uint src = Tableau + col;
+		Card card = colTop(pos, col);
+		if (!card) continue;
+		if (home(pos, card)) {
+			moves[len++] = (struct Move) { Foundation, src, 1 };
+		}
+		uint run = runLen(pos, col);
+		uint cap = supermove(free, spaces);
+		const Card *cards = &pos->cards[colStart(pos, col) + pos->len[col]];
+		for (uint dst = 0; dst < Cols; ++dst) {
+			Card top = colTop(pos, dst);
+			if (!top || dst == col) continue;
+			for (uint n = 1; n <= run && n <= cap; ++n) {
+				if (!stacks(cards[-(int)n], top)) continue;
+				moves[len++] = (struct Move) { Tableau + dst, src, n };
+				break;
+			}
+		}
+		// Any part of the run can go to an empty column, and which card
+		// that leaves on top matters, so every length is tried for the
+		// search to be complete.
+		if (empty < Stacks) {
+			cap = supermove(free, spaces - 1);
+			if (run > cap) run = cap;
+			for (uint n = run; n; --n) {
+				if (n == pos->len[col]) continue;
+				moves[len++] = (struct Move) { empty, src, n };
+			}
+		}
+		if (cell < Stacks) moves[len++] = (struct Move) { cell, src, 1 };
+	}
+	return len;
+}
+
+enum { MovesCap = Cells * (Cols + 2) + Cols * (Cols + 14) };
+
+struct Entry {
+	int prio;
+	uint32_t node;
+};
+
+static void heapPush(struct Entry *heap, uint *len, struct Entry entry) {
+	uint i = (*len)++;
+	while (i && heap[(i - 1) / 2].prio > entry.prio) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = entry;
+}
+
+static struct Entry heapPop(struct Entry *heap, uint *len) {
+	struct Entry top = heap[0];
+	struct Entry last = heap[--*len];
+	uint i = 0;
+	for (;;) {
+		uint child = 2 * i + 1;
+		if (child >= *len) break;
+		if (child + 1 < *len && heap[child + 1].prio < heap[child].prio) {
+			child++;
+		}
+		if (heap[child].prio >= last.prio) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+static bool seen(uint64_t *table, uint64_t mask, uint64_t hash) {
+	for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+		if (table[i] == hash) return true;
+		if (!table[i]) {
+			table[i] = hash;
+			return false;
+		}
+	}
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct Pos position(const struct Stack stacks[static Stacks]) {
+	struct Pos pos = {0};
+	for (uint i = Foundation; i < Cell; ++i) {
+		if (!stacks[i].len) continue;
+		pos.found[suit(stacks[i].cards[0])] = stacks[i].len;
+	}
+	for (uint i = 0; i < Cells; ++i) {
+		if (stacks[Cell + i].len) pos.cells[i] = stacks[Cell + i].cards[0];
+	}
+	uint n = 0;
+	for (uint i = 0; i < Cols; ++i) {
+		pos.len[i] = stacks[Tableau + i].len;
+		memcpy(&pos.cards[n], stacks[Tableau + i].cards, pos.len[i]);
+		n += pos.len[i];
+	}
+	return pos;
+}
+
+enum Solve solve(
+	struct Solution *solution, const struct Stack stacks[static Stacks],
+	uint budget, uint cap
+) {
+	solution->len = 0;
+	solution->nodes = 0;
+	uint64_t mask = 1;
+	while (mask < 2 * (uint64_t)cap) mask <<= 1;
+	uint64_t *table = calloc(mask, sizeof(*table));
+	struct Node *nodes = malloc(sizeof(*nodes) * cap);
+	struct Entry *heap = malloc(sizeof(*heap) * cap);
+	if (!table || !nodes || !heap) err(EX_OSERR, "malloc");
+	mask--;
+
+	uint len = 0, heapLen = 0;
+	nodes[len++] = (struct Node) { .pos = position(stacks) };
+	seen(table, mask, hash(&nodes[0].pos));
+	heapPush(heap, &heapLen, (struct Entry) { 0, 0 });
+
+	double deadline = now() + budget / 1000.0;
+	bool pruned = false;
+	uint found = UINT32_MAX;
+	while (heapLen && found == UINT32_MAX) {
+		if (!(solution->nodes & 0xFF) && budget && now() > deadline) {
+			pruned = true;
+			break;
+		}
+		uint32_t parent = heapPop(heap, &heapLen).node;
+		solution->nodes++;
+		if (won(&nodes[parent].pos)) {
+			found = parent;
+			break;
+		}
+		if (nodes[parent].depth + 1 >= SolveLen) {
+			pruned = true;
+			continue;
+		}
+		struct Move buf[MovesCap];
+		uint n = moves(&nodes[parent].pos, buf);
+		for (uint i = 0; i < n; ++i) {
+			if (len == cap) {
+				pruned = true;
+				break;
+			}
+			struct Node *node = &nodes[len];
+			node->pos = nodes[parent].pos;
+			apply(&node->pos, buf[i].dst, buf[i].src, buf[i].len);
+			autoMove(&node->pos);
+			if (seen(table, mask, hash(&node->pos))) continue;
+			node->parent = parent;
+			node->depth = nodes[parent].depth + 1;
+			node->dst = buf[i].dst;
+			node->src = buf[i].src;
+			node->len = buf[i].len;
+			int prio = 4 * heuristic(&node->pos) + node->depth;
+			heapPush(heap, &heapLen, (struct Entry) { prio, len });
+			len++;
+		}
+		if (len == cap) break;
+	}
+
+	if (found != UINT32_MAX) {
+		solution->len = nodes[found].depth;
+		for (uint32_t i = found; i; i = nodes[i].parent) {
+			uint j = nodes[i].depth - 1;
+			solution->moves[j].dst = nodes[i].dst;
+			solution->moves[j].src = nodes[i].src;
+			solution->moves[j].len = nodes[i].len;
+		}
+		solution->result = Solved;
+	} else {
+		solution->result = (pruned || heapLen ? GaveUp : Unsolvable);
+	}
+	free(table);
+	free(nodes);
+	free(heap);
+	return solution->result;
+}
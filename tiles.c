@@ -0,0 +1,185 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "play.h"
+
+// The kernels take the size as a parameter but are always inlined into a
+// function per size, where it is a constant, so each size gets its loops
+// and shifts folded for it. Rows too wide to tabulate as grid.c does are
+// slid a nibble at a time instead.
+
+// Slide, merge, slide, as in grid.c, tiles stopping at 2^15. A merge
+// bumps the exponent already placed, so the row is only read once. Rows
+// slide towards nibble 0, or back towards nibble n-1.
+static inline __attribute__((always_inline))
+uint32_t slide(uint32_t row, uint n, bool back, uint *score) {
+	uint32_t result = 0;
+	uint to = 0;
+	uint last = 0;
+	for (uint i = 0; i < n; ++i) {
+		uint cell = row >> (4 * (back ? n - 1 - i : i)) & 0xF;
+		if (!cell) continue;
+		if (cell == last && cell != 0xF) {
+			result += (uint32_t)1 << (4 * (back ? n - to : to - 1));
+			if (score) *score += 1 << (cell + 1);
+			last = 0;
+		} else {
+			result |= (uint32_t)cell << (4 * (back ? n - 1 - to : to));
+			to++;
+			last = cell;
+		}
+	}
+	return result;
+}
+
+// Rows of three are few enough to tabulate.
+enum { Rows3 = 1 << 12 };
+static uint16_t row3Left[Rows3];
+static uint16_t row3Right[Rows3];
+static uint row3Score[Rows3];
+
+void tilesInit(void) {
+	if (row3Score[0x011]) return;
+	for (uint row = 0; row < Rows3; ++row) {
+		uint score = 0;
+		row3Left[row] = slide(row, 3, false, &score);
+		row3Right[row] = slide(row, 3, true, NULL);
+		row3Score[row] = score;
+	}
+}
+
+// Swaps the high b nibbles of each 2b in row a with the low b in row c.
+static inline __attribute__((always_inline))
+void swap(uint32_t *a, uint32_t *c, uint b, uint32_t mask) {
+	uint32_t t = (*a >> (4 * b) ^ *c) & mask;
+	*a ^= t << (4 * b);
+	*c ^= t;
+}
+
+// Transposes as a 4x4 or 8x8 board, which the cells past n leave zero, by
+// swapping the off-diagonal blocks of each size in turn, as gridTranspose
+// does with two swaps for its 4x4.
+static inline __attribute__((always_inline))
+void transpose(uint32_t rows[static TilesMax], uint n) {
+	if (n > 4) {
+		swap(&rows[0], &rows[4], 4, 0x0000FFFF);
+		swap(&rows[1], &rows[5], 4, 0x0000FFFF);
+		swap(&rows[2], &rows[6], 4, 0x0000FFFF);
+		swap(&rows[3], &rows[7], 4, 0x0000FFFF);
+		swap(&rows[4], &rows[6], 2, 0x00FF00FF);
+		swap(&rows[5], &rows[7], 2, 0x00FF00FF);
+		swap(&rows[4], &rows[5], 1, 0x0F0F0F0F);
+		swap(&rows[6], &rows[7], 1, 0x0F0F0F0F);
+	}
+	swap(&rows[0], &rows[2], 2, 0x00FF00FF);
+	swap(&rows[1], &rows[3], 2, 0x00FF00FF);
+	swap(&rows[0], &rows[1], 1, 0x0F0F0F0F);
+	swap(&rows[2], &rows[3], 1, 0x0F0F0F0F);
+}
+
+static inline __attribute__((always_inline))
+struct Tiles move(
+	const struct Tiles *tiles, uint n, enum Dir dir, uint *score
+) {
+	bool cols = (dir == Up || dir == Down);
+	bool back = (dir == Right || dir == Down);
+	uint32_t rows[TilesMax];
+	memcpy(rows, tiles->rows, sizeof(rows));
+	if (cols) transpose(rows, n);
+	for (uint y = 0; y < n; ++y) {
+		uint32_t row = rows[y];
+		if (!row) continue;
+		if (n == 3) {
+			rows[y] = (back ? row3Right : row3Left)[row];
+			if (score) *score += row3Score[row];
+		} else {
+			rows[y] = slide(row, n, back, score);
+		}
+	}
+	if (cols) transpose(rows, n);
+	struct Tiles result = { .n = n };
+	memcpy(result.rows, rows, sizeof(rows));
+	return result;
+}
+
+static struct Tiles
+move3(const struct Tiles *tiles, enum Dir dir, uint *score) {
+	return move(tiles, 3, dir, score);
+}
+static struct Tiles
+move5(const struct Tiles *tiles, enum Dir dir, uint *score) {
+	return move(tiles, 5, dir, score);
+}
+static struct Tiles
+move6(const struct Tiles *tiles, enum Dir dir, uint *score) {
+	return move(tiles, 6, dir, score);
+}
+static struct Tiles
+move8(const struct Tiles *tiles, enum Dir dir, uint *score) {
+	return move(tiles, 8, dir, score);
+}
+
+struct Tiles tilesMove(struct Tiles tiles, enum Dir dir, uint *score) {
+	switch (tiles.n) {
+		case 3:  return move3(&tiles, dir, score);
+		case 5:  return move5(&tiles, dir, score);
+		case 6:  return move6(&tiles, dir, score);
+		case 8:  return move8(&tiles, dir, score);
+		default: return move(&tiles, tiles.n, dir, score);
+	}
+}
+
+bool tilesEqual(struct Tiles a, struct Tiles b) {
+	return !memcmp(a.rows, b.rows, sizeof(a.rows));
+}
+
+bool tilesOver(struct Tiles tiles) {
+	for (enum Dir dir = Left; dir < Dirs; ++dir) {
+		if (!tilesEqual(tilesMove(tiles, dir, NULL), tiles)) return false;
+	}
+	return true;
+}
+
+uint tilesEmpty(struct Tiles tiles) {
+	uint empty = 0;
+	for (uint y = 0; y < tiles.n; ++y) {
+		for (uint x = 0; x < tiles.n; ++x) {
+			empty += !tilesTile(&tiles, y, x);
+		}
+	}
+	return empty;
+}
+
+// Places a tile of exponent exp in the nth empty cell, in row order.
+struct Tiles tilesPut(struct Tiles tiles, uint n, uint exp) {
+	for (uint y = 0; y < tiles.n; ++y) {
+		for (uint x = 0; x < tiles.n; ++x) {
+			if (tilesTile(&tiles, y, x) || n--) continue;
+			tiles.rows[y] |= (uint32_t)exp << (4 * x);
+			return tiles;
+		}
+	}
+	return tiles;
+}
+
+struct Tiles tilesSpawn(struct Tiles tiles, struct Rng *rng) {
+	uint n = rngUniform(rng, tilesEmpty(tiles));
+	return tilesPut(tiles, n, (rngUniform(rng, 10) ? 1 : 2));
+}
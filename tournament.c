@@ -0,0 +1,382 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <curses.h>
+#include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Every entrant of a tournament plays from its seed, and owns one slot of
+// a shared table for the whole game. Only the entrant stores to its slot,
+// each on its own cache line, and the standings only ever load from the
+// table, so neither waits on the other or on a lock. Opening and closing
+// are rare and take a lock on the file between themselves.
+
+enum { Slots = TournamentSlots };
+
+enum SlotState {
+	SlotFree,
+	SlotPlaying,
+	SlotDone,
+};
+
+// Joining puts a slot back to SlotFree before storing its id. The name
+// and date are written before state leaves SlotFree, and don't change
+// after.
+struct Slot {
+	alignas(64) atomic_uint_least64_t id;
+	atomic_uint_least32_t state;
+	atomic_uint_least32_t score;
+	atomic_uint_least64_t steps;
+	int64_t date;
+	char name[sizeof(((struct Score *)0)->name)];
+};
+
+static const char Magic[8] = "tourney\1";
+
+enum { Closed, Open };
+
+// Sessions only join while state is Open, which is stored last when
+// opening, so the fields before it are set by then. Each tournament has a
+// new id, so entrants of an earlier one can't take slots of this one.
+struct Tournament {
+	char magic[8];
+	atomic_uint_least64_t id;
+	atomic_uint_least32_t state;
+	atomic_uint_least32_t entrants;
+	char game[32];
+	uint64_t seed;
+	int64_t start, end;
+	struct Slot slots[Slots];
+};
+
+static uint64_t get(const atomic_uint_least64_t *x) {
+	return atomic_load_explicit(
+		(atomic_uint_least64_t *)x, memory_order_relaxed
+	);
+}
+
+static uint32_t get32(const atomic_uint_least32_t *x) {
+	return atomic_load_explicit(
+		(atomic_uint_least32_t *)x, memory_order_relaxed
+	);
+}
+
+// Writers set the table up under a lock on fd, which readers don't need.
+static struct Tournament *tournamentMap(int fd, bool write) {
+	struct Tournament *map = NULL;
+	struct stat st;
+	int error = fstat(fd, &st);
+	if (write && !error && st.st_size != sizeof(*map)) {
+		error = ftruncate(fd, 0) || ftruncate(fd, sizeof(*map));
+	} else if (!error && st.st_size != sizeof(*map)) {
+		return NULL;
+	}
+	if (error) return NULL;
+	map = mmap(
+		NULL, sizeof(*map), PROT_READ | (write ? PROT_WRITE : 0), MAP_SHARED,
+		fd, 0
+	);
+	if (map == MAP_FAILED) return NULL;
+	if (memcmp(map->magic, Magic, sizeof(Magic))) {
+		if (!write) {
+			munmap(map, sizeof(*map));
+			return NULL;
+		}
+		memset(map, 0, sizeof(*map));
+		memcpy(map->magic, Magic, sizeof(Magic));
+	}
+	return map;
+}
+
+static int lockFile(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) return -1;
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static const struct Tournament *readMap(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) err(EX_NOINPUT, "%s", path);
+	const struct Tournament *map = tournamentMap(fd, false);
+	if (!map) errx(EX_NOINPUT, "%s: no tournament", path);
+	close(fd);
+	return map;
+}
+
+static struct {
+	struct Slot *slot;
+	uint64_t steps;
+} entry;
+
+// Takes a slot in the open tournament of game, if there is one, and
+// returns its seed and end. The table stays mapped for the session.
+bool tournamentJoin(
+	const char *path, const char *game, uint64_t *seed, time_t *end
+) {
+	int fd = lockFile(path);
+	if (fd < 0) return false;
+	struct Tournament *map = tournamentMap(fd, true);
+	close(fd);
+	if (!map) return false;
+	time_t now = time(NULL);
+	if (
+		atomic_load_explicit(&map->state, memory_order_acquire) != Open ||
+		strncmp(map->game, game, sizeof(map->game)) ||
+		now < map->start || now >= map->end
+	) goto fail;
+	uint64_t id = get(&map->id);
+	uint n = atomic_fetch_add(&map->entrants, 1);
+	if (n >= Slots || get(&map->id) != id) goto fail;
+	struct Slot *slot = &map->slots[n];
+	atomic_store_explicit(&slot->state, SlotFree, memory_order_relaxed);
+	slot->date = now;
+	atomic_store_explicit(&slot->score, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->steps, 0, memory_order_relaxed);
+	atomic_store_explicit(&slot->id, id, memory_order_release);
+	*seed = map->seed;
+	*end = map->end;
+	entry.slot = slot;
+	return true;
+fail:
+	munmap(map, sizeof(*map));
+	return false;
+}
+
+// The entrant appears in the standings once named.
+void tournamentName(const char *name) {
+	if (!entry.slot) return;
+	snprintf(entry.slot->name, sizeof(entry.slot->name), "%s", name);
+	atomic_store_explicit(
+		&entry.slot->state, SlotPlaying, memory_order_release
+	);
+}
+
+void tournamentScore(uint score) {
+	if (!entry.slot) return;
+	entry.steps++;
+	atomic_store_explicit(&entry.slot->score, score, memory_order_relaxed);
+	atomic_store_explicit(
+		&entry.slot->steps, entry.steps, memory_order_relaxed
+	);
+}
+
+void tournamentDone(uint score) {
+	if (!entry.slot) return;
+	atomic_store_explicit(&entry.slot->score, score, memory_order_relaxed);
+	atomic_store_explicit(&entry.slot->state, SlotDone, memory_order_release);
+}
+
+struct Standing {
+	uint score;
+	uint64_t steps;
+	enum SlotState state;
+	time_t date;
+	char name[sizeof(((struct Slot *)0)->name)];
+};
+
+// Higher scores first, then fewer steps to reach them.
+static int compareStanding(const void *_a, const void *_b) {
+	const struct Standing *a = _a, *b = _b;
+	if (a->score != b->score) {
+		return (a->score < b->score) - (a->score > b->score);
+	}
+	return (a->steps > b->steps) - (a->steps < b->steps);
+}
+
+static struct Standing standings[Slots];
+
+static size_t rank(const struct Tournament *map) {
+	uint64_t id = get(&map->id);
+	uint entrants = get32(&map->entrants);
+	if (entrants > Slots) entrants = Slots;
+	size_t len = 0;
+	for (uint i = 0; i < entrants; ++i) {
+		const struct Slot *slot = &map->slots[i];
+		if (
+			atomic_load_explicit(
+				(atomic_uint_least64_t *)&slot->id, memory_order_acquire
+			) != id
+		) continue;
+		uint state = atomic_load_explicit(
+			(atomic_uint_least32_t *)&slot->state, memory_order_acquire
+		);
+		if (state == SlotFree) continue;
+		struct Standing *standing = &standings[len++];
+		standing->state = state;
+		standing->score = get32(&slot->score);
+		standing->steps = get(&slot->steps);
+		standing->date = slot->date;
+		memcpy(standing->name, slot->name, sizeof(standing->name));
+		standing->name[sizeof(standing->name) - 1] = '\0';
+	}
+	qsort(standings, len, sizeof(*standings), compareStanding);
+	return len;
+}
+
+static void draw(const struct Tournament *map) {
+	erase();
+	char title[sizeof(map->game) + 64];
+	time_t now = time(NULL);
+	if (get32(&map->state) != Open) {
+		snprintf(title, sizeof(title), "%s TOURNAMENT (CLOSED)", map->game);
+	} else if (now < map->end) {
+		long left = map->end - now;
+		snprintf(
+			title, sizeof(title), "%s TOURNAMENT (%ld:%02ld LEFT)",
+			map->game, left / 60, left % 60
+		);
+	} else {
+		snprintf(title, sizeof(title), "%s TOURNAMENT (OVER)", map->game);
+	}
+	mvaddstr(BoardY + 0, BoardX, boardTitle(title));
+	mvaddstr(BoardY + 1, BoardX, boardLine());
+	size_t len = rank(map);
+	for (size_t i = 0; i < len && (int)i < LINES - BoardY - 4; ++i) {
+		const struct Standing *standing = &standings[i];
+		attr_set(
+			(standing->state == SlotPlaying ? A_BOLD : A_NORMAL), 0, NULL
+		);
+		mvprintw(
+			BoardY + 2 + i, BoardX, "%*zu. %*u  %-*s  %s",
+			RankWidth, 1 + i, ScoreWidth, standing->score,
+			NameWidth, standing->name,
+			(standing->state == SlotPlaying ? "playing" : "")
+		);
+	}
+	attr_set(A_NORMAL, 0, NULL);
+	mvaddstr(LINES - 1, BoardX, "Press q to quit.");
+}
+
+// Shows the standings once a second until q.
+int tournamentShow(const char *path) {
+	const struct Tournament *map = readMap(path);
+	initscr();
+	cbreak();
+	noecho();
+	curs_set(0);
+	timeout(1000);
+	for (;;) {
+		draw(map);
+		refresh();
+		int ch = getch();
+		if (ch == 'q') break;
+	}
+	endwin();
+	return EX_OK;
+}
+
+// Starts a tournament of game from seed, lasting minutes from now. One
+// still running can't be replaced.
+int tournamentOpen(
+	const char *path, const char *game, uint64_t seed, uint minutes
+) {
+	int lock = lockFile(path);
+	if (lock < 0) err(EX_CANTCREAT, "%s", path);
+	struct Tournament *map = tournamentMap(lock, true);
+	if (!map) err(EX_CANTCREAT, "%s", path);
+	time_t now = time(NULL);
+	if (get32(&map->state) == Open && now < map->end) {
+		errx(EX_TEMPFAIL, "%s: %s tournament still open", path, map->game);
+	}
+	atomic_store(&map->state, Closed);
+	atomic_fetch_add(&map->id, 1);
+	for (uint i = 0; i < Slots; ++i) {
+		atomic_store(&map->slots[i].state, SlotFree);
+	}
+	atomic_store(&map->entrants, 0);
+	snprintf(map->game, sizeof(map->game), "%s", game);
+	map->seed = seed;
+	map->start = now;
+	map->end = now + 60 * (time_t)minutes;
+	atomic_store_explicit(&map->state, Open, memory_order_release);
+	time_t end = map->end;
+	printf(
+		"%s tournament %" PRIu64 " seed %" PRIu64 " until %s",
+		game, get(&map->id), seed, ctime(&end)
+	);
+	munmap(map, sizeof(*map));
+	close(lock);
+	return EX_OK;
+}
+
+// Closes the tournament and writes its final ranking to the game's
+// tournament board, in place of any earlier one.
+int tournamentClose(const char *path) {
+	int lock = lockFile(path);
+	if (lock < 0) err(EX_NOINPUT, "%s", path);
+	struct Tournament *map = tournamentMap(lock, true);
+	if (!map) err(EX_NOINPUT, "%s", path);
+	if (get32(&map->state) != Open) errx(EX_DATAERR, "%s: not open", path);
+	atomic_store(&map->state, Closed);
+	size_t len = rank(map);
+
+	char board[64];
+	snprintf(board, sizeof(board), "%s.tournament", map->game);
+	FILE *file = scoresOpen(board);
+	scoresLock(file);
+	memset(scores, 0, sizeof(scores));
+	for (size_t i = 0; i < len && i < ScoresLen; ++i) {
+		struct Score *score = &scores[i];
+		score->date = standings[i].date;
+		score->score = standings[i].score;
+		memcpy(score->name, standings[i].name, sizeof(score->name));
+	}
+	scoresWrite(file);
+	fclose(file);
+	printf("%s: %zu entrants ranked\n", board, len);
+	munmap(map, sizeof(*map));
+	close(lock);
+	return EX_OK;
+}
+
+// Prints the standings as tab-separated values.
+int tournamentPrint(const char *path) {
+	const struct Tournament *map = readMap(path);
+	printf(
+		"# %s tournament %" PRIu64 " seed %" PRIu64 " %s\n",
+		map->game, get(&map->id), map->seed,
+		(get32(&map->state) == Open ? "open" : "closed")
+	);
+	size_t len = rank(map);
+	for (size_t i = 0; i < len; ++i) {
+		const struct Standing *standing = &standings[i];
+		printf(
+			"%zu\t%u\t%" PRIu64 "\t%s\t%s\n",
+			1 + i, standing->score, standing->steps, standing->name,
+			(standing->state == SlotPlaying ? "playing" : "done")
+		);
+	}
+	return (ferror(stdout) ? EX_IOERR : EX_OK);
+}
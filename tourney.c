@@ -0,0 +1,56 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <utils/arc4random.h>
+
+#include "play.h"
+
+// Opens a tournament with -g, closes it onto its board with -c, or prints
+// its standings. Sessions of the game started before it ends join it.
+int main(int argc, char *argv[]) {
+	const char *path = "play.tournament";
+	const char *game = NULL;
+	bool closing = false;
+	bool seeded = false;
+	uint minutes = 60;
+	uint64_t seed = 0;
+	for (int opt; 0 < (opt = getopt(argc, argv, "cf:g:m:s:"));) {
+		switch (opt) {
+			break; case 'c': closing = true;
+			break; case 'f': path = optarg;
+			break; case 'g': game = optarg;
+			break; case 'm': minutes = strtoul(optarg, NULL, 10);
+			break; case 's': {
+				seed = strtoull(optarg, NULL, 0);
+				seeded = true;
+			}
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (closing) return tournamentClose(path);
+	if (!game) return tournamentPrint(path);
+	if (!recordEngine(game)) errx(EX_USAGE, "%s isn't recorded", game);
+	if (!minutes) errx(EX_USAGE, "no minutes");
+	if (!seeded) arc4random_buf(&seed, sizeof(seed));
+	return tournamentOpen(path, game, seed, minutes);
+}
@@ -0,0 +1,235 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "play.h"
+
+// Marks the entries of scoreboards whose sessions replay, from their
+// recordings, to the same score. A recording belongs to an entry if its
+// session started at the entry's date.
+
+struct Job {
+	char path[256];
+	time_t date;
+	bool loaded;
+	uint score;
+};
+
+static struct {
+	const struct Engine *engine;
+	struct Job *jobs;
+	size_t cap, len;
+	atomic_size_t next;
+	atomic_ullong steps;
+} batch;
+
+static void replay(struct Job *job, void *state) {
+	FILE *file = fopen(job->path, "r");
+	if (!file) {
+		warn("%s", job->path);
+		return;
+	}
+	struct Recording rec;
+	bool ok = recordLoad(&rec, file);
+	fclose(file);
+	if (!ok) {
+		warnx("%s: not a recording", job->path);
+		return;
+	}
+	const struct Engine *engine = batch.engine;
+	struct Rng rng;
+	if (!recordReset(&rec, engine, state, &rng)) {
+		warnx("%s: bad save", job->path);
+		recordFree(&rec);
+		return;
+	}
+	size_t i;
+	for (i = 0; i < rec.len; ++i) {
+		uint events = engine->step(state, rec.steps[i].key, &rng);
+		if (events & EventDone) break;
+	}
+	job->loaded = true;
+	job->score = engine->score(state);
+	batch.steps += i;
+	recordFree(&rec);
+}
+
+static void *work(void *ptr) {
+	(void)ptr;
+	void *state = calloc(1, batch.engine->size);
+	if (!state) err(EX_OSERR, "calloc");
+	for (size_t i; (i = batch.next++) < batch.len;) {
+		replay(&batch.jobs[i], state);
+	}
+	if (batch.engine->fini) batch.engine->fini(state);
+	free(state);
+	return NULL;
+}
+
+static int compareDate(const void *a, const void *b) {
+	time_t x = *(const time_t *)a, y = *(const time_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Queues the recordings of a game from sessions started at one of dates.
+static void scan(
+	const char *dir, const char *game, const time_t *dates, size_t len
+) {
+	DIR *entries = opendir(dir);
+	if (!entries) err(EX_NOINPUT, "%s", dir);
+	batch.len = 0;
+	for (struct dirent *entry; (entry = readdir(entries));) {
+		if (entry->d_name[0] == '.') continue;
+		char path[sizeof(batch.jobs->path)];
+		int pathLen = snprintf(
+			path, sizeof(path), "%s/%s", dir, entry->d_name
+		);
+		if (pathLen < 0 || (size_t)pathLen >= sizeof(path)) continue;
+		FILE *file = fopen(path, "r");
+		if (!file) continue;
+		struct RecordHead head;
+		size_t n = fread(&head, sizeof(head), 1, file);
+		fclose(file);
+		if (!n || memcmp(head.magic, RecordMagic, sizeof(RecordMagic))) {
+			continue;
+		}
+		head.game[sizeof(head.game) - 1] = '\0';
+		if (strcmp(head.game, game)) continue;
+		time_t date = head.date;
+		if (!bsearch(&date, dates, len, sizeof(*dates), compareDate)) {
+			continue;
+		}
+		if (batch.len == batch.cap) {
+			batch.cap = (batch.cap ? batch.cap * 2 : 256);
+			batch.jobs = realloc(
+				batch.jobs, sizeof(*batch.jobs) * batch.cap
+			);
+			if (!batch.jobs) err(EX_OSERR, "realloc");
+		}
+		struct Job *job = &batch.jobs[batch.len++];
+		*job = (struct Job) { .date = date };
+		memcpy(job->path, path, sizeof(path));
+	}
+	closedir(entries);
+}
+
+static bool verified(const struct Score *score) {
+	for (size_t i = 0; i < batch.len; ++i) {
+		const struct Job *job = &batch.jobs[i];
+		if (!job->loaded || job->date != score->date) continue;
+		if (job->score == score->score) return true;
+	}
+	return false;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	const char *dir = "recordings";
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool dry = false;
+	bool verbose = false;
+	for (int opt; 0 < (opt = getopt(argc, argv, "d:j:nv"));) {
+		switch (opt) {
+			break; case 'd': dir = optarg;
+			break; case 'j': threads = strtol(optarg, NULL, 10);
+			break; case 'n': dry = true;
+			break; case 'v': verbose = true;
+			break; default:  return EX_USAGE;
+		}
+	}
+	if (optind == argc) errx(EX_USAGE, "no scoreboards");
+	if (threads < 1) threads = 1;
+	pthread_t *thread = calloc(threads, sizeof(*thread));
+	if (!thread) err(EX_OSERR, "calloc");
+	gridInit();
+	tilesInit();
+
+	static time_t dates[ScoresLen];
+	for (int i = optind; i < argc; ++i) {
+		const char *path = argv[i];
+		const char *base = strrchr(path, '/');
+		base = (base ? base + 1 : path);
+		char game[32];
+		snprintf(game, sizeof(game), "%.*s", (int)strcspn(base, "."), base);
+		batch.engine = recordEngine(game);
+		if (!batch.engine) errx(EX_USAGE, "%s: %s isn't recorded", path, game);
+
+		FILE *file = fopen(path, (dry ? "r" : "r+"));
+		if (!file) err(EX_NOINPUT, "%s", path);
+		scoresRead(file);
+		size_t len = 0;
+		for (size_t j = 0; j < ScoresLen && scores[j].score; ++j) {
+			dates[len++] = scores[j].date;
+		}
+		qsort(dates, len, sizeof(*dates), compareDate);
+
+		double start = now();
+		scan(dir, game, dates, len);
+		batch.next = 0;
+		batch.steps = 0;
+		for (long j = 0; j < threads; ++j) {
+			int error = pthread_create(&thread[j], NULL, work, NULL);
+			if (error) errx(EX_OSERR, "pthread_create: %s", strerror(error));
+		}
+		for (long j = 0; j < threads; ++j) {
+			pthread_join(thread[j], NULL);
+		}
+		double elapsed = now() - start;
+
+		// The board may have changed while replaying, so entries are
+		// matched again under the lock.
+		if (!dry) scoresLock(file);
+		scoresRead(file);
+		size_t entries = 0, marked = 0;
+		for (size_t j = 0; j < ScoresLen && scores[j].score; ++j) {
+			entries++;
+			if (verified(&scores[j])) {
+				scores[j].flags |= ScoreVerified;
+				marked++;
+			} else {
+				scores[j].flags &= ~ScoreVerified;
+				if (verbose) printf("%s: %s\n", path, boardScore(j));
+			}
+		}
+		if (!dry) scoresWrite(file);
+		fclose(file);
+
+		unsigned long long steps = batch.steps;
+		printf(
+			"%s entries %zu verified %zu recordings %zu steps %llu"
+			" threads %ld elapsed %.3f replays/s %.1f\n",
+			path, entries, marked, batch.len, steps,
+			threads, elapsed, batch.len / elapsed
+		);
+	}
+	free(batch.jobs);
+	free(thread);
+}
@@ -0,0 +1,150 @@
+/* Copyright (C) 2021  C. McEnroe <june@causal.agency>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "play.h"
+
+enum {
+	Rows = WormRows,
+	Cols = WormCols,
+};
+
+void wormInit(struct Worm *worm) {
+	*worm = (struct Worm) {
+		.body = { .len = 1, .bits[0] = 1 },
+		.head = { Rows / 2, Cols / 2, 0, 1 },
+	};
+}
+
+void wormTurn(struct Worm *worm, int dy, int dx) {
+	if (dy == -worm->head.dy && dx == -worm->head.dx) return;
+	worm->head.dy = dy;
+	worm->head.dx = dx;
+}
+
+static void foodRemove(struct Worm *worm, uint i) {
+	worm->food.bits[worm->food.y[i]] &= ~(1ULL << worm->food.x[i]);
+	worm->food.len--;
+	worm->food.y[i] = worm->food.y[worm->food.len];
+	worm->food.x[i] = worm->food.x[worm->food.len];
+	worm->food.age[i] = worm->food.age[worm->food.len];
+}
+
+static uint64_t freeCells(const struct Worm *worm, int y) {
+	uint64_t cells = ~(worm->body.bits[y] | worm->food.bits[y]);
+	cells &= (1ULL << Cols) - 1;
+	if (y == worm->head.y) cells &= ~(1ULL << worm->head.x);
+	return cells;
+}
+
+// Also leaves out the cell the head is about to enter, where food would
+// be hidden under the body until it spoiled. The single try never minded,
+// but once the board is nearly full the uniform pick would land there
+// all the time.
+static uint64_t pickCells(const struct Worm *worm, int y) {
+	uint64_t cells = freeCells(worm, y);
+	int x = worm->head.x + worm->head.dx;
+	if (y == worm->head.y + worm->head.dy && x >= 0 && x < Cols) {
+		cells &= ~(1ULL << x);
+	}
+	return cells;
+}
+
+// One random try as before, and a uniform pick over the free cells when
+// the try misses, so food still lands when the board is nearly full.
+static void foodPlace(struct Worm *worm, struct Rng *rng) {
+	int y = rngUniform(rng, Rows);
+	int x = rngUniform(rng, Cols);
+	if (!(freeCells(worm, y) >> x & 1)) {
+		uint len = 0;
+		for (y = 0; y < Rows; ++y) {
+			len += __builtin_popcountll(pickCells(worm, y));
+		}
+		if (!len) return;
+		uint n = rngUniform(rng, len);
+		uint64_t cells = 0;
+		for (y = 0; y < Rows; ++y) {
+			cells = pickCells(worm, y);
+			uint count = __builtin_popcountll(cells);
+			if (n < count) break;
+			n -= count;
+		}
+		while (n--) cells &= cells - 1;
+		x = __builtin_ctzll(cells);
+	}
+	worm->food.y[worm->food.len] = y;
+	worm->food.x[worm->food.len] = x;
+	worm->food.age[worm->food.len] = 0;
+	worm->food.bits[y] |= 1ULL << x;
+	worm->food.len++;
+	worm->stats.placed++;
+}
+
+void wormTick(struct Worm *worm, struct Rng *rng) {
+	bool grow = false;
+	int y = worm->head.y + worm->head.dy;
+	int x = worm->head.x + worm->head.dx;
+	for (uint i = 0; i < worm->food.len; ++i) {
+		if (y != worm->food.y[i] || x != worm->food.x[i]) continue;
+		uint age = worm->food.age[i];
+		if (age > FoodSpoil) {
+			worm->over = "You ate spoiled food!";
+			return;
+		}
+		worm->score += worm->body.len * (age > FoodRipe ? 2 : 1);
+		if (age > FoodRipe) {
+			worm->stats.ripe++;
+		} else {
+			worm->stats.fresh++;
+		}
+		foodRemove(worm, i);
+		grow = true;
+		break;
+	}
+	for (uint i = worm->food.len - 1; i < worm->food.len; --i) {
+		if (worm->food.age[i]++ < FoodMulch) continue;
+		foodRemove(worm, i);
+		worm->stats.mulched++;
+	}
+	if (
+		!worm->food.len ||
+		(worm->food.len < FoodCap && !rngUniform(rng, FoodChance))
+	) {
+		foodPlace(worm, rng);
+	}
+
+	if (grow) {
+		worm->body.len++;
+	} else {
+		uint tail = wormSegment(worm, worm->body.len - 1);
+		worm->body.bits[worm->body.y[tail]] &= ~(1ULL << worm->body.x[tail]);
+	}
+	uint first = (worm->body.first ? worm->body.first : WormCap) - 1;
+	worm->body.first = first;
+	worm->body.y[first] = worm->head.y;
+	worm->body.x[first] = worm->head.x;
+	worm->body.bits[worm->head.y] |= 1ULL << worm->head.x;
+
+	worm->head.y = y;
+	worm->head.x = x;
+	if (y < 0 || x < 0 || y >= Rows || x >= Cols) {
+		worm->over = "You eated the wall D:";
+	} else if (worm->body.bits[y] >> x & 1) {
+		worm->over = "You eated yourself :(";
+	}
+}